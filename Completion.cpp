@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Completion.hpp"
+
+/**
+ * Creates an empty completion index
+ */
+CompletionIndex::CompletionIndex ()
+{
+	build ();
+}
+
+
+/**
+ * Destroys the completion index
+ */
+CompletionIndex::~CompletionIndex ()
+{
+}
+
+
+/**
+ * Pulls the command and cvar names out of part of a cvarlist reply, a line split across two
+ * replies is held until the rest of it arrives
+ */
+void CompletionIndex::addListing (const char *text, uint32_t length)
+{
+	const char *end = text + length;
+	const char *line = text;
+
+	while (line < end)
+	{
+		const char *line_end = (const char *)memchr (line, '\n', end - line);
+		if (line_end == NULL)
+		{
+			partial_line.append (line, end - line);
+			break;
+		}
+		partial_line.append (line, line_end - line);
+		line = line_end + 1;
+
+		// Listing lines look like "name : value : flags : description", anything else is a header
+		size_t name_end = partial_line.find_first_of (" \t:");
+		if ((name_end != std::string::npos) && (name_end > 0) && (partial_line.find (" : ") != std::string::npos))
+		{
+			addName (partial_line.substr (0, name_end));
+		}
+		partial_line.clear ();
+	}
+}
+
+
+/**
+ * Adds a single name, it can be completed once the index is next built
+ */
+void CompletionIndex::addName (const std::string &name)
+{
+	pending.push_back (name);
+}
+
+
+/**
+ * Returns true if names were added since the index was last built
+ */
+bool CompletionIndex::needsBuild (void)
+{
+	return !pending.empty ();
+}
+
+
+/**
+ * Sorts the names and rebuilds the trie over them
+ */
+void CompletionIndex::build (void)
+{
+	entries.insert (entries.end (), pending.begin (), pending.end ());
+	pending.clear ();
+	std::sort (entries.begin (), entries.end ());
+	entries.erase (std::unique (entries.begin (), entries.end ()), entries.end ());
+
+	struct CompletionNode root;
+	root.first_child = 0;
+	root.first_entry = 0;
+	root.entry_count = entries.size ();
+	root.child_count = 0;
+	root.label = 0;
+
+	nodes.clear ();
+	nodes.push_back (root);
+	buildChildren (0, 0);
+}
+
+
+/**
+ * Adds the children of a node, splitting its names up by their character at the given depth
+ */
+void CompletionIndex::buildChildren (uint32_t node, uint32_t depth)
+{
+	uint32_t next = nodes[node].first_entry;
+	uint32_t last = next + nodes[node].entry_count;
+
+	// Names that end at this node sort before the longer ones
+	while ((next < last) && (entries[next].size () <= depth))
+	{
+		next++;
+	}
+
+	uint32_t first_child = nodes.size ();
+	while (next < last)
+	{
+		struct CompletionNode child;
+		child.label = entries[next][depth];
+		child.first_entry = next;
+		child.first_child = 0;
+		child.child_count = 0;
+		while ((next < last) && (entries[next][depth] == child.label))
+		{
+			next++;
+		}
+		child.entry_count = next - child.first_entry;
+		nodes.push_back (child);
+	}
+	nodes[node].first_child = first_child;
+	nodes[node].child_count = nodes.size () - first_child;
+
+	for (uint32_t t = first_child; t < first_child + nodes[node].child_count; t++)
+	{
+		buildChildren (t, depth + 1);
+	}
+}
+
+
+/**
+ * Finds the names starting with the prefix, returns how many there are in total and copies
+ * up to max_matches of them into matches
+ */
+size_t CompletionIndex::complete (const std::string &prefix, std::vector<std::string> &matches, size_t max_matches)
+{
+	if (needsBuild ())
+	{
+		build ();
+	}
+
+	// Walk down the trie, searching each nodes children for the next character
+	uint32_t node = 0;
+	for (size_t t = 0; t < prefix.size (); t++)
+	{
+		uint32_t low = nodes[node].first_child;
+		uint32_t high = low + nodes[node].child_count;
+		unsigned char wanted = prefix[t];
+		while (low < high)
+		{
+			uint32_t middle = low + (high - low) / 2;
+			if ((unsigned char)nodes[middle].label < wanted)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		if ((low >= nodes[node].first_child + nodes[node].child_count) || ((unsigned char)nodes[low].label != wanted))
+		{
+			return 0;
+		}
+		node = low;
+	}
+
+	// Everything below the node is a match, and they already sit together in order
+	uint32_t first = nodes[node].first_entry;
+	uint32_t count = nodes[node].entry_count;
+	for (uint32_t t = first; (t < first + count) && (matches.size () < max_matches); t++)
+	{
+		matches.push_back (entries[t]);
+	}
+	return count;
+}
+
+
+/**
+ * Finds the names containing the patterns characters in order, returns how many there are in
+ * total and copies up to max_matches of them into matches
+ */
+size_t CompletionIndex::fuzzy (const std::string &pattern, std::vector<std::string> &matches, size_t max_matches)
+{
+	if (needsBuild ())
+	{
+		build ();
+	}
+
+	size_t count = 0;
+	for (size_t t = 0; t < entries.size (); t++)
+	{
+		const std::string &entry = entries[t];
+		size_t p = 0;
+		for (size_t c = 0; (c < entry.size ()) && (p < pattern.size ()); c++)
+		{
+			if (entry[c] == pattern[p])
+			{
+				p++;
+			}
+		}
+		if (p == pattern.size ())
+		{
+			if (matches.size () < max_matches)
+			{
+				matches.push_back (entry);
+			}
+			count++;
+		}
+	}
+	return count;
+}
+
+
+/**
+ * Returns how many names the index holds
+ */
+size_t CompletionIndex::size (void)
+{
+	return entries.size () + pending.size ();
+}
+
+
+/**
+ * Adds the names from a cache file written by save, returns how many were read or -1
+ */
+int CompletionIndex::load (const char *file_name)
+{
+	FILE *cache_file = fopen (file_name, "r");
+	if (cache_file == NULL)
+	{
+		return -1;
+	}
+
+	// getline grows the line to fit, so long names aren't split
+	int count = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	while (getline (&line, &line_size, cache_file) != -1)
+	{
+		size_t length = strcspn (line, "\r\n");
+		if (length > 0)
+		{
+			pending.push_back (std::string (line, length));
+			count++;
+		}
+	}
+	free (line);
+	fclose (cache_file);
+
+	build ();
+	return count;
+}
+
+
+/**
+ * Writes the names out one per line, returns how many were written or -1
+ */
+int CompletionIndex::save (const char *file_name)
+{
+	if (needsBuild ())
+	{
+		build ();
+	}
+
+	FILE *cache_file = fopen (file_name, "w");
+	if (cache_file == NULL)
+	{
+		return -1;
+	}
+	for (size_t t = 0; t < entries.size (); t++)
+	{
+		fprintf (cache_file, "%s\n", entries[t].c_str ());
+	}
+	fclose (cache_file);
+
+	return entries.size ();
+}
+
+
+/**
+ * Names the cache file for a server, the reply to its version command is hashed into the name so an
+ * update that changes its commands starts a new cache rather than completing from the old one
+ */
+std::string CompletionIndex::cacheName (const std::string &address, const std::string &port, const std::string &version)
+{
+	std::string file_name = "SSRCON." + address + "_" + port;
+	if (!version.empty ())
+	{
+		// 64 bit FNV-1a
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t t = 0; t < version.size (); t++)
+		{
+			hash ^= (uint8_t)version[t];
+			hash *= 1099511628211ULL;
+		}
+		char hash_text[17];
+		snprintf (hash_text, sizeof (hash_text), "%016llx", (unsigned long long)hash);
+		file_name += "_";
+		file_name += hash_text;
+	}
+	return file_name + ".completions";
+}
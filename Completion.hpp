@@ -0,0 +1,56 @@
+#ifndef	_COMPLETION_H
+#define _COMPLETION_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// How many completions are shown at once
+#define COMPLETION_MAX_SHOWN	20
+
+// Define the CompletionIndex class
+class CompletionIndex;
+
+// Build the CompletionIndex class Template
+class CompletionIndex
+{
+private:
+	// A trie node, its children sit next to each other in the node list sorted by label, and
+	// every name below it sits next to each other in the sorted name list
+	struct CompletionNode
+	{
+		uint32_t first_child;
+		uint32_t first_entry;
+		uint32_t entry_count;
+		uint16_t child_count;
+		char label;
+	};
+
+	// Private variables
+	std::vector<std::string> entries;
+	std::vector<std::string> pending;
+	std::vector<struct CompletionNode> nodes;
+	std::string partial_line;
+
+	// Private methods
+	void buildChildren (uint32_t node, uint32_t depth);
+
+public:
+	// Constructors and destructor
+	CompletionIndex ();
+	~CompletionIndex ();
+
+	// Public methods
+	void addListing (const char *text, uint32_t length);
+	void addName (const std::string &name);
+	bool needsBuild (void);
+	void build (void);
+	size_t complete (const std::string &prefix, std::vector<std::string> &matches, size_t max_matches);
+	size_t fuzzy (const std::string &pattern, std::vector<std::string> &matches, size_t max_matches);
+	size_t size (void);
+	int load (const char *file_name);
+	int save (const char *file_name);
+	static std::string cacheName (const std::string &address, const std::string &port, const std::string &version);
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "History.hpp"
+
+/**
+ * Opens the archive and its index for appending, creating them if needed
+ */
+History::History (const char *file_name)
+{
+	std::string index_name = std::string (file_name) + HISTORY_INDEX_SUFFIX;
+
+	data_file = fopen (file_name, "ab");
+	index_file = fopen (index_name.c_str (), "ab");
+	data_size = 0;
+	if (data_file != NULL)
+	{
+		fseek (data_file, 0, SEEK_END);
+		data_size = ftell (data_file);
+	}
+
+	// Always index the first record written, so anything added since the last run can be found
+	records_since_index = HISTORY_INDEX_EVERY;
+}
+
+
+/**
+ * Closes the archive
+ */
+History::~History ()
+{
+	if (data_file != NULL)
+	{
+		fclose (data_file);
+		data_file = NULL;
+	}
+	if (index_file != NULL)
+	{
+		fclose (index_file);
+		index_file = NULL;
+	}
+}
+
+
+/**
+ * Adds a command and its whole response, gathered from every part of the reply, to the end of the archive
+ */
+int History::append (const std::string &server, int32_t msg_id, const std::string &command, const char *response, uint32_t response_length)
+{
+	if ((data_file == NULL) || (index_file == NULL))
+	{
+		return -1;
+	}
+
+	struct HistoryRecord record;
+	memset (&record, 0, sizeof (record));
+	record.magic = HISTORY_RECORD_MAGIC;
+	record.response_length = response_length;
+	record.time = time (NULL);
+	record.server_length = (server.size () > UINT16_MAX) ? UINT16_MAX : server.size ();
+	record.command_length = (command.size () > UINT16_MAX) ? UINT16_MAX : command.size ();
+	record.msg_id = msg_id;
+
+	// Point the index at this record every so often
+	if (records_since_index >= HISTORY_INDEX_EVERY)
+	{
+		struct HistoryIndex index;
+		index.time = record.time;
+		index.offset = data_size;
+		fwrite (&index, sizeof (index), 1, index_file);
+		fflush (index_file);
+		records_since_index = 0;
+	}
+	records_since_index++;
+
+	fwrite (&record, sizeof (record), 1, data_file);
+	fwrite (server.data (), 1, record.server_length, data_file);
+	fwrite (command.data (), 1, record.command_length, data_file);
+	fwrite (response, 1, response_length, data_file);
+	fflush (data_file);
+
+	data_size += sizeof (record) + record.server_length + record.command_length + response_length;
+	return 1;
+}
+
+
+/**
+ * Prints every record between the two times, only for the given server and command when
+ * they're not NULL, and returns how many were found or -1 if the archive couldn't be read
+ */
+int History::query (const char *file_name, time_t from, time_t to, const char *server, const char *command)
+{
+	std::string index_name = std::string (file_name) + HISTORY_INDEX_SUFFIX;
+	int found = 0;
+
+	// Map the archive and index rather than reading them in
+	int data_fd = open (file_name, O_RDONLY);
+	int index_fd = open (index_name.c_str (), O_RDONLY);
+	struct stat data_stat;
+	struct stat index_stat;
+	if ((data_fd < 0) || (index_fd < 0) || (fstat (data_fd, &data_stat) != 0) || (fstat (index_fd, &index_stat) != 0))
+	{
+		printf ("Unable to open the history archive %s.\n", file_name);
+		if (data_fd >= 0)
+		{
+			close (data_fd);
+		}
+		if (index_fd >= 0)
+		{
+			close (index_fd);
+		}
+		return -1;
+	}
+
+	uint64_t data_size = data_stat.st_size;
+	uint64_t index_count = index_stat.st_size / sizeof (struct HistoryIndex);
+	const uint8_t *data = NULL;
+	const struct HistoryIndex *index = NULL;
+	if (data_size > 0)
+	{
+		data = (const uint8_t *)mmap (NULL, data_size, PROT_READ, MAP_SHARED, data_fd, 0);
+	}
+	if (index_count > 0)
+	{
+		index = (const struct HistoryIndex *)mmap (NULL, index_count * sizeof (struct HistoryIndex), PROT_READ, MAP_SHARED, index_fd, 0);
+	}
+	close (data_fd);
+	close (index_fd);
+	if ((data == MAP_FAILED) || (index == MAP_FAILED))
+	{
+		printf ("Unable to map the history archive %s.\n", file_name);
+		return -1;
+	}
+
+	// Find the last index entry before the start time, everything before it can be skipped
+	uint64_t offset = 0;
+	uint64_t low = 0;
+	uint64_t high = index_count;
+	while (low < high)
+	{
+		uint64_t middle = low + (high - low) / 2;
+		if (index[middle].time < from)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	if ((low > 0) && (index[low-1].offset < data_size))
+	{
+		offset = index[low-1].offset;
+	}
+
+	// Walk the records from there until they pass the end time
+	size_t server_length = (server != NULL) ? strlen (server) : 0;
+	size_t command_length = (command != NULL) ? strlen (command) : 0;
+	while (offset + sizeof (struct HistoryRecord) <= data_size)
+	{
+		struct HistoryRecord record;
+		memcpy (&record, &data[offset], sizeof (record));
+		uint64_t record_size = sizeof (record) + record.server_length + record.command_length + record.response_length;
+		if ((record.magic != HISTORY_RECORD_MAGIC) || (offset + record_size > data_size))
+		{
+			printf ("History archive is damaged at offset %llu, stopping.\n", (unsigned long long)offset);
+			break;
+		}
+		if (record.time > to)
+		{
+			break;
+		}
+
+		const char *record_server = (const char *)&data[offset + sizeof (record)];
+		const char *record_command = record_server + record.server_length;
+		const char *record_response = record_command + record.command_length;
+		offset += record_size;
+
+		// Check the record is one that was asked for
+		if ((record.time < from) ||
+			((server != NULL) && ((record.server_length != server_length) || (memcmp (record_server, server, server_length) != 0))) ||
+			((command != NULL) && ((record.command_length != command_length) || (memcmp (record_command, command, command_length) != 0))))
+		{
+			continue;
+		}
+
+		char time_buffer[21];
+		time_t record_time = record.time;
+		struct tm record_tm;
+		gmtime_r (&record_time, &record_tm);
+		strftime (time_buffer, 21, "%Y/%m/%d %H:%M:%S", &record_tm);
+
+		printf ("%s %.*s %d: %.*s\n", time_buffer, record.server_length, record_server, record.msg_id, record.command_length, record_command);
+		fwrite (record_response, 1, record.response_length, stdout);
+		if ((record.response_length == 0) || (record_response[record.response_length-1] != '\n'))
+		{
+			fputc ('\n', stdout);
+		}
+		found++;
+	}
+
+	if (data != NULL)
+	{
+		munmap ((void *)data, data_size);
+	}
+	if (index != NULL)
+	{
+		munmap ((void *)index, index_count * sizeof (struct HistoryIndex));
+	}
+	return found;
+}
@@ -0,0 +1,60 @@
+#ifndef	_HISTORY_H
+#define _HISTORY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+
+// Defines the archive file names, the index file sits beside the data file
+#define HISTORY_FILE			"SSRCON.history"
+#define HISTORY_INDEX_SUFFIX	".idx"
+
+// Marks the start of every record, used to spot a damaged archive
+#define HISTORY_RECORD_MAGIC	0x31485253
+
+// How many records to write between each index entry
+#define HISTORY_INDEX_EVERY		64
+
+// The header written before each record, followed by the server, command and response
+struct HistoryRecord
+{
+	uint32_t magic;
+	uint32_t response_length;
+	int64_t time;
+	uint16_t server_length;
+	uint16_t command_length;
+	int32_t msg_id;
+};
+
+// The sparse index entry, pointing at the record written at that time
+struct HistoryIndex
+{
+	int64_t time;
+	uint64_t offset;
+};
+
+// Define the History class
+class History;
+
+// Build the History class Template
+class History
+{
+private:
+	// Private variables
+	FILE *data_file;
+	FILE *index_file;
+	uint64_t data_size;
+	uint32_t records_since_index;
+
+public:
+	// Constructors and destructor
+	History (const char *file_name);
+	~History ();
+
+	// Public methods
+	int append (const std::string &server, int32_t msg_id, const std::string &command, const char *response, uint32_t response_length);
+	static int query (const char *file_name, time_t from, time_t to, const char *server, const char *command);
+};
+
+#endif
@@ -0,0 +1,339 @@
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "LoadTest.hpp"
+#include "RCONSession.hpp"
+
+// A command the load test sends and how often it's picked
+struct LoadCommand
+{
+	std::string command;
+	uint32_t weight;
+	uint64_t sent;
+	uint64_t replied;
+};
+
+// What every session adds its results to
+struct LoadResults
+{
+	std::vector<struct LoadCommand> commands;
+	std::vector<uint64_t> latencies;
+	uint64_t steady_start;
+	uint64_t steady_sent;
+	uint64_t replies;
+};
+
+// A command waiting for its first reply, timed from when it should have been sent
+struct LoadRequest
+{
+	int32_t msg_id;
+	uint64_t intended;
+	size_t command;
+};
+
+// One of the sessions driving the load
+struct LoadSession
+{
+	RCONSession *session;
+	std::deque<struct LoadRequest> waiting;
+	struct LoadResults *results;
+};
+
+extern volatile sig_atomic_t closing_process;
+
+/**
+ * Returns a steady time in microseconds
+ */
+static uint64_t loadMicros (void)
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+
+/**
+ * Matches a reply to the command waiting on it, later parts of a multi packet reply are ignored
+ */
+static void loadReply (void *user_data, int32_t msg_id, const char *, uint32_t)
+{
+	struct LoadSession *load_session = (struct LoadSession *)user_data;
+	struct LoadResults *results = load_session->results;
+
+	// Replies come back in the order the commands were sent
+	while ((!load_session->waiting.empty ()) && (load_session->waiting.front ().msg_id <= msg_id))
+	{
+		struct LoadRequest request = load_session->waiting.front ();
+		load_session->waiting.pop_front ();
+		if (request.msg_id == msg_id)
+		{
+			results->commands[request.command].replied++;
+			results->replies++;
+			if (request.intended >= results->steady_start)
+			{
+				results->latencies.push_back (loadMicros () - request.intended);
+			}
+		}
+	}
+}
+
+
+/**
+ * Reads a mix like "status:5,cvarlist:1" into the command list, returns the total weight
+ */
+static uint32_t parseMix (const char *mix, std::vector<struct LoadCommand> &commands)
+{
+	uint32_t total_weight = 0;
+	std::string mix_text = mix;
+	size_t start = 0;
+
+	while (start <= mix_text.size ())
+	{
+		size_t end = mix_text.find (',', start);
+		if (end == std::string::npos)
+		{
+			end = mix_text.size ();
+		}
+
+		std::string entry = mix_text.substr (start, end - start);
+		struct LoadCommand command;
+		command.weight = 1;
+		command.sent = 0;
+		command.replied = 0;
+		size_t weight_start = entry.rfind (':');
+		if (weight_start != std::string::npos)
+		{
+			command.weight = strtoul (entry.c_str () + weight_start + 1, NULL, 10);
+			entry.erase (weight_start);
+		}
+		command.command = entry;
+		if ((command.command.length () > 0) && (command.weight > 0))
+		{
+			commands.push_back (command);
+			total_weight += command.weight;
+		}
+
+		start = end + 1;
+	}
+
+	return total_weight;
+}
+
+
+/**
+ * Opens session_count sessions to the server and sends the command mix at a fixed rate for
+ * duration seconds, ramping up over the first ramp seconds, then reports the latencies measured
+ * from when each command should have been sent, so a slow server can't hide its own queueing
+ */
+int runLoadTest (Logger *logger, const char *address, int port, const char *password, uint8_t dialect,
+	uint32_t session_count, double rate, uint32_t duration, uint32_t ramp, const char *mix)
+{
+	struct LoadResults results;
+	results.replies = 0;
+	results.steady_sent = 0;
+	uint32_t total_weight = parseMix (mix, results.commands);
+	if ((total_weight == 0) || (session_count == 0) || (rate <= 0))
+	{
+		logger->log (": Load test needs at least one session, a rate and a command.\n");
+		return -1;
+	}
+
+	// Connect and authorise every session before any load is sent
+	std::vector<struct LoadSession> sessions (session_count);
+	uint32_t open_sessions = 0;
+	for (uint32_t t = 0; t < session_count; t++)
+	{
+		sessions[t].session = RCONSession::create (logger, dialect);
+		sessions[t].results = &results;
+		sessions[t].session->setReplyCallback (&loadReply, &sessions[t]);
+		if ((sessions[t].session->connectServer (address, port) == 1) &&
+			(sessions[t].session->authenticate (password) == 1))
+		{
+			open_sessions++;
+		}
+	}
+	logger->logf (": Load test opened %u of %u sessions.\n", open_sessions, session_count);
+
+	uint64_t start = loadMicros ();
+	uint64_t end = start + (uint64_t)duration * 1000000ULL;
+	uint64_t drain_end = end + 5000000ULL;
+	results.steady_start = start + (uint64_t)ramp * 1000000ULL;
+	uint64_t next_send = start;
+	uint64_t send_count = 0;
+	uint64_t ramp_count = (uint64_t)(rate * ramp / 2.0);
+	uint32_t next_session = 0;
+	uint64_t errors = 0;
+	std::vector<struct pollfd> poll_fds (session_count);
+
+	uint64_t now = start;
+	while ((open_sessions > 0) && (closing_process != 1) && (now < drain_end))
+	{
+		// Send everything that is due, whether or not earlier commands have been answered
+		while ((next_send <= now) && (next_send < end) && (open_sessions > 0))
+		{
+			uint32_t pick = rand () % total_weight;
+			size_t command = 0;
+			while (pick >= results.commands[command].weight)
+			{
+				pick -= results.commands[command].weight;
+				command++;
+			}
+
+			while (sessions[next_session].session->getState () != RCON_RUNNING)
+			{
+				next_session = (next_session + 1) % session_count;
+			}
+			struct LoadSession *load_session = &sessions[next_session];
+			next_session = (next_session + 1) % session_count;
+
+			int32_t msg_id = load_session->session->exec (results.commands[command].command);
+			if (msg_id >= 0)
+			{
+				struct LoadRequest request;
+				request.msg_id = msg_id;
+				request.intended = next_send;
+				request.command = command;
+				load_session->waiting.push_back (request);
+				results.commands[command].sent++;
+
+				// The achieved rate only counts what actually went out between the ramp and the end
+				uint64_t sent_at = loadMicros ();
+				if ((sent_at >= results.steady_start) && (sent_at < end))
+				{
+					results.steady_sent++;
+				}
+			}
+			else
+			{
+				errors++;
+			}
+
+			// Work out when the next command is due, while ramping the rate climbs in a straight
+			// line so the nth command is due at sqrt (2 * ramp * n / rate)
+			send_count++;
+			if (send_count < ramp_count)
+			{
+				next_send = start + (uint64_t)(sqrt (2.0 * ramp * send_count / rate) * 1000000.0);
+			}
+			else
+			{
+				next_send = results.steady_start + (uint64_t)((send_count - ramp_count) * 1000000.0 / rate);
+			}
+
+			// Drop sessions that closed while sending
+			if (load_session->session->getState () == RCON_CLOSE)
+			{
+				errors += load_session->waiting.size ();
+				load_session->waiting.clear ();
+				load_session->session->disconnect ();
+				open_sessions--;
+			}
+		}
+
+		// Stop once the test is over and every reply is in
+		bool waiting = false;
+		for (uint32_t t = 0; t < session_count; t++)
+		{
+			waiting = waiting || !sessions[t].waiting.empty ();
+			poll_fds[t].fd = (sessions[t].session->getState () == RCON_RUNNING) ? sessions[t].session->getSocket () : -1;
+			poll_fds[t].events = POLLIN;
+			poll_fds[t].revents = 0;
+		}
+		if ((now >= end) && (!waiting))
+		{
+			break;
+		}
+
+		// Wait for replies until the next command is due
+		uint64_t wait = 100000;
+		if ((next_send < end) && (next_send > now) && (next_send - now < wait))
+		{
+			wait = next_send - now;
+		}
+		else if ((next_send < end) && (next_send <= now))
+		{
+			wait = 0;
+		}
+		struct timespec timeout;
+		timeout.tv_sec = wait / 1000000;
+		timeout.tv_nsec = (wait % 1000000) * 1000;
+		ppoll (&poll_fds[0], session_count, &timeout, NULL);
+
+		for (uint32_t t = 0; t < session_count; t++)
+		{
+			if (poll_fds[t].revents == 0)
+			{
+				continue;
+			}
+			if ((sessions[t].session->poll () < 0) && (sessions[t].session->getState () == RCON_CLOSE))
+			{
+				errors += sessions[t].waiting.size ();
+				sessions[t].waiting.clear ();
+				sessions[t].session->disconnect ();
+				open_sessions--;
+			}
+		}
+
+		now = loadMicros ();
+	}
+
+	// Anything still waiting never got a reply
+	uint64_t timeouts = 0;
+	for (uint32_t t = 0; t < session_count; t++)
+	{
+		timeouts += sessions[t].waiting.size ();
+		delete sessions[t].session;
+	}
+
+	// Report the results
+	uint64_t sent = 0;
+	for (size_t c = 0; c < results.commands.size (); c++)
+	{
+		sent += results.commands[c].sent;
+	}
+	double achieved = 0.0;
+	if (duration > ramp)
+	{
+		achieved = (double)results.steady_sent / (duration - ramp);
+	}
+	else if (duration > 0)
+	{
+		achieved = (double)sent / duration;
+	}
+	logger->logf (": Load test sent %llu commands to %u sessions over %u seconds, target %.1f/s, achieved %.1f/s.\n",
+		(unsigned long long)sent, session_count, duration, rate, achieved);
+	logger->logf (": Load test had %llu replies, %llu errors and %llu commands without a reply.\n",
+		(unsigned long long)results.replies, (unsigned long long)errors, (unsigned long long)timeouts);
+	for (size_t c = 0; c < results.commands.size (); c++)
+	{
+		logger->logf (":   %s: weight %u, sent %llu, replied %llu.\n", results.commands[c].command.c_str (), results.commands[c].weight,
+			(unsigned long long)results.commands[c].sent, (unsigned long long)results.commands[c].replied);
+	}
+
+	if (results.latencies.size () > 0)
+	{
+		std::sort (results.latencies.begin (), results.latencies.end ());
+		size_t count = results.latencies.size ();
+		logger->logf (": Load test latency after ramp up (ms): p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f over %llu replies.\n",
+			results.latencies[count * 50 / 100] / 1000.0, results.latencies[count * 90 / 100] / 1000.0,
+			results.latencies[count * 99 / 100] / 1000.0, results.latencies[count * 999 / 1000] / 1000.0,
+			results.latencies[count - 1] / 1000.0, (unsigned long long)count);
+	}
+	else
+	{
+		logger->log (": Load test had no replies after ramp up to measure.\n");
+	}
+
+	return ((errors == 0) && (timeouts == 0)) ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+#ifndef	_LOADTEST_H
+#define _LOADTEST_H
+
+#include <stdint.h>
+
+#include "Logger.hpp"
+
+int runLoadTest (Logger *logger, const char *address, int port, const char *password, uint8_t dialect,
+	uint32_t session_count, double rate, uint32_t duration, uint32_t ramp, const char *mix);
+
+#endif
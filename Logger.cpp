@@ -1,9 +1,14 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
 #include <string>
 #include <pthread.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "Logger.hpp"
 #include "SSRCON.hpp"
@@ -20,6 +25,19 @@ Logger::Logger ()
 	last_log_line = "";
 	last_log_count = 0;
 	log_mutex = PTHREAD_MUTEX_INITIALIZER;
+	log_file_size = 0;
+	log_file_opened = 0;
+	max_log_size = 0;
+	max_log_age = 0;
+	max_log_files = 1;
+	compress_logs = false;
+	compress_pid = 0;
+	log_format = LOG_FORMAT_TEXT;
+	time_stamp_second = 0;
+	memset (time_stamp, 0, 21);
+	reply_id = 0;
+	reply_open = false;
+	reply_line_start = true;
 
 	// Report logger initialisation
 	//logf (": Initialised with log file: %s.\n", log_file_name.c_str ());
@@ -38,6 +56,19 @@ Logger::Logger (const char *log_file_location)
 	last_log_line = "";
 	last_log_count = 0;
 	log_mutex = PTHREAD_MUTEX_INITIALIZER;
+	log_file_size = 0;
+	log_file_opened = 0;
+	max_log_size = 0;
+	max_log_age = 0;
+	max_log_files = 1;
+	compress_logs = false;
+	compress_pid = 0;
+	log_format = LOG_FORMAT_TEXT;
+	time_stamp_second = 0;
+	memset (time_stamp, 0, 21);
+	reply_id = 0;
+	reply_open = false;
+	reply_line_start = true;
 
 	// Report logger initialisation
 	logf (": Initialised with log file: %s\n", log_file_name.c_str ());
@@ -49,7 +80,7 @@ Logger::Logger (const char *log_file_location)
  */
 Logger::~Logger ()
 {
-	log_file = NULL;
+	closeLogFile ();
 }
 
 
@@ -58,8 +89,11 @@ Logger::~Logger ()
  */
 void Logger::setLogFileLocation (const char *log_file_location)
 {
+	lock (log_mutex);
+	closeLogFile ();
 	log_file_name = log_file_location;
-	logf (" LOGGER: Initialised with log file: %s.\n", log_file_name.c_str ());
+	release (log_mutex);
+	logf (": Initialised with log file: %s.\n", log_file_name.c_str ());
 }
 
 
@@ -81,18 +115,77 @@ void Logger::setDebugLevel (uint8_t new_debug_level)
 }
 
 
+/**
+ * Sets whether the log file is written as plain text lines or JSON lines
+ */
+void Logger::setLogFormat (uint8_t new_log_format)
+{
+	lock (log_mutex);
+	log_format = new_log_format;
+	release (log_mutex);
+}
+
+
+/**
+ * Sets the server name added to structured log records
+ */
+void Logger::setServerName (const char *new_server_name)
+{
+	lock (log_mutex);
+	server_name = new_server_name;
+	release (log_mutex);
+}
+
+
+/**
+ * Returns the current debug level
+ */
+uint8_t Logger::getDebugLevel (void)
+{
+	return debug_level;
+}
+
+
+/**
+ * Starts a new log file once the current one reaches max_size bytes or is max_age seconds
+ * old, keeping max_files old files and gzipping them if compress is set, 0 disables a limit
+ */
+void Logger::setRotation (uint64_t max_size, uint32_t max_age, uint8_t max_files, bool compress)
+{
+	lock (log_mutex);
+
+	max_log_size = max_size;
+	max_log_age = max_age;
+	max_log_files = (max_files > 0) ? max_files : 1;
+	compress_logs = compress;
+
+	release (log_mutex);
+}
+
+
 /**
  * Opens a file so the can log messages
  */
 int Logger::initLogFile (void)
 {
-        log_file = fopen (log_file_name.c_str (), "a+");
-        if (log_file == NULL)
-        {
-			printf ("%s: Logger unable to open log file.\n", line_prefix);
-			return -1;
-        }
-        return 1;
+	// The log file is kept open between lines
+	if (log_file != NULL)
+	{
+		return 1;
+	}
+
+	log_file = fopen (log_file_name.c_str (), "a");
+	if (log_file == NULL)
+	{
+		printf ("%s: Logger unable to open log file.\n", line_prefix);
+		return -1;
+	}
+
+	// Carry on the size of a file that already exists
+	fseek (log_file, 0, SEEK_END);
+	log_file_size = ftell (log_file);
+	log_file_opened = time (NULL);
+	return 1;
 }
 
 
@@ -103,6 +196,7 @@ void Logger::log (const char *line)
 {
 	lock (log_mutex);
 
+	breakReply ();
 	printf("%s%s", line_prefix, line);
 
 	// If this log message was only just sent
@@ -114,38 +208,235 @@ void Logger::log (const char *line)
 	{
 		if (initLogFile() == 1)
 		{
-			char time_buffer[21];
-
-			memset(time_buffer, 0, 21);
-			time_t time_of_day;
-			time (&time_of_day);
-			strftime (time_buffer, 21, "%Y/%m/%d %H:%M:%S ", gmtime(&time_of_day));
-
 			// Store how many times the last message repeated
 			last_log_line = line;
-			if (last_log_count > 0)
+			writeRepeatCount ();
+
+			if (log_format == LOG_FORMAT_JSON)
+			{
+				writeRecord ("info", NULL, 0, line, strlen (line));
+			}
+			else
 			{
-				char buffer[64];
-				std::string log_repeat;
+				fprintf (log_file, "%s%s%s", getTimeStamp (), line_prefix, line);
+			}
 
-				snprintf (buffer, 64, "(Last message repeated %d times.)\n", last_log_count);
-				log_repeat = buffer;
+			flushLogFile ();
+		}
+	}
+
+	release (log_mutex);
+}
 
-				fprintf (log_file, "%s%s", time_buffer, log_repeat.c_str ());
 
-				last_log_count = 0;
+/**
+ * Writes a message body of any length straight to the screen and logfile, without
+ * copying it through a format buffer
+ */
+void Logger::logMessage (const char *direction, int32_t msg_id, const char *body, size_t body_length)
+{
+	lock (log_mutex);
+
+	breakReply ();
+	// Build the line from its parts so it can be written without copying the body
+	struct iovec line[6];
+	line[0].iov_base = (void *)line_prefix;
+	line[0].iov_len = strlen (line_prefix);
+	line[1].iov_base = (void *)": ";
+	line[1].iov_len = 2;
+	line[2].iov_base = (void *)direction;
+	line[2].iov_len = strlen (direction);
+	line[3].iov_base = (void *)": ";
+	line[3].iov_len = 2;
+	line[4].iov_base = (void *)body;
+	line[4].iov_len = body_length;
+	line[5].iov_base = (void *)"\n";
+	line[5].iov_len = 1;
+
+	if (initLogFile() == 1)
+	{
+		// Store how many times the last message repeated
+		last_log_line.clear ();
+		writeRepeatCount ();
+
+		if (log_format == LOG_FORMAT_JSON)
+		{
+			writeRecord ("info", direction, msg_id, body, body_length);
+		}
+		else
+		{
+			fputs (getTimeStamp (), log_file);
+			for (int t = 0; t < 6; t++)
+			{
+				fwrite (line[t].iov_base, 1, line[t].iov_len, log_file);
 			}
+		}
 
-			fprintf (log_file, "%s%s%s", time_buffer, line_prefix, line);
+		flushLogFile ();
+	}
+
+	writeScreen (line, 6);
 
-			closeLogFile ();
+	release (log_mutex);
+}
+
+
+/**
+ * Streams one part of a reply to the screen and logfile as it arrives, the prefix is only written
+ * before the first part so lines split between parts come out whole, endReply finishes the line
+ */
+void Logger::logReplyPart (const char *direction, int32_t msg_id, const char *body, size_t body_length)
+{
+	lock (log_mutex);
+
+	// Anything still open belongs to another reply
+	if ((reply_open) && (reply_id != msg_id))
+	{
+		breakReply ();
+	}
+	bool first = !reply_open;
+
+	struct iovec line[5];
+	line[0].iov_base = (void *)line_prefix;
+	line[0].iov_len = strlen (line_prefix);
+	line[1].iov_base = (void *)": ";
+	line[1].iov_len = 2;
+	line[2].iov_base = (void *)direction;
+	line[2].iov_len = strlen (direction);
+	line[3].iov_base = (void *)": ";
+	line[3].iov_len = 2;
+	line[4].iov_base = (void *)body;
+	line[4].iov_len = body_length;
+
+	// Later parts carry on from where the last one stopped, without a prefix
+	struct iovec *part = (first) ? line : &line[4];
+	int part_count = (first) ? 5 : 1;
+
+	if (initLogFile() == 1)
+	{
+		if (first)
+		{
+			// Store how many times the last message repeated
+			last_log_line.clear ();
+			writeRepeatCount ();
 		}
+
+		// Each part is its own record, as a record can't be left open
+		if (log_format == LOG_FORMAT_JSON)
+		{
+			writeRecord ("info", direction, msg_id, body, body_length);
+		}
+		else
+		{
+			if (first)
+			{
+				fputs (getTimeStamp (), log_file);
+			}
+			for (int t = 0; t < part_count; t++)
+			{
+				fwrite (part[t].iov_base, 1, part[t].iov_len, log_file);
+			}
+		}
+
+		flushLogFile ();
+	}
+
+	writeScreen (part, part_count);
+
+	reply_id = msg_id;
+	reply_open = true;
+	if (body_length > 0)
+	{
+		reply_line_start = (body[body_length - 1] == '\n');
+	}
+	else if (first)
+	{
+		reply_line_start = false;
+	}
+
+	release (log_mutex);
+}
+
+
+/**
+ * Finishes the line of a streamed reply once the whole reply has arrived, unless it already
+ * ended with a newline
+ */
+void Logger::endReply (int32_t msg_id)
+{
+	lock (log_mutex);
+
+	if ((reply_open) && (reply_id == msg_id))
+	{
+		breakReply ();
 	}
 
 	release (log_mutex);
 }
 
 
+/**
+ * Ends the line of the reply being streamed, so whatever is written next starts on its own line
+ * and the rest of the reply starts again with a prefix
+ */
+void Logger::breakReply (void)
+{
+	if (!reply_open)
+	{
+		return;
+	}
+
+	if (!reply_line_start)
+	{
+		struct iovec line;
+		line.iov_base = (void *)"\n";
+		line.iov_len = 1;
+		writeScreen (&line, 1);
+		if ((log_format == LOG_FORMAT_TEXT) && (log_file != NULL))
+		{
+			fputc ('\n', log_file);
+			flushLogFile ();
+		}
+	}
+	reply_open = false;
+	reply_line_start = true;
+}
+
+
+/**
+ * Hands the parts of a line to the screen in one write, picking up after any short write
+ */
+void Logger::writeScreen (struct iovec *line, int count)
+{
+	fflush (stdout);
+	struct iovec *next = line;
+	int remaining = count;
+	while (remaining > 0)
+	{
+		ssize_t written = writev (STDOUT_FILENO, next, remaining);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		while ((remaining > 0) && ((size_t)written >= next->iov_len))
+		{
+			written -= next->iov_len;
+			next++;
+			remaining--;
+		}
+		if (remaining > 0)
+		{
+			next->iov_base = (char *)next->iov_base + written;
+			next->iov_len -= written;
+		}
+	}
+}
+
+
 /**
  * Uses the given format and agruments to build the line to send to printLog
  */
@@ -176,15 +467,15 @@ void Logger::logx (unsigned char hex, bool end_line)
 	{
 		printf ("\n");
 	}
-	if (initLogFile() == 1)
+	// Hex dumps would break up the records of a structured log
+	if ((log_format == LOG_FORMAT_TEXT) && (initLogFile() == 1))
 	{
 		fprintf (log_file, "%02x ", hex);
 		if (end_line)
 		{
 			fprintf (log_file, "\n");
+			flushLogFile ();
 		}
-
-		closeLogFile ();
 	}
 
 	release (log_mutex);
@@ -200,6 +491,7 @@ void Logger::debug (uint8_t debug_level, const char *line)
 
 	if (debug_level <= this->debug_level)
 	{
+		breakReply ();
 		printf("%s DEBUG %d%s", line_prefix, debug_level, line);
 
 		// If this log message was only just sent
@@ -211,31 +503,22 @@ void Logger::debug (uint8_t debug_level, const char *line)
 		{
 			if (initLogFile() == 1)
 			{
-				char time_buffer[21];
-
-				memset(time_buffer, 0, 21);
-				time_t time_of_day;
-				time (&time_of_day);
-				strftime (time_buffer, 21, "%Y/%m/%d %H:%M:%S ", gmtime(&time_of_day));
-
 				// Store how many times the last message repeated
 				last_log_line = line;
-				if (last_log_count > 0)
-				{
-					char buffer[64];
-					std::string log_repeat;
-
-					snprintf (buffer, 64, "(Last message repeated %d times.)\n", last_log_count);
-					log_repeat = buffer;
-
-					fprintf (log_file, "%s%s", time_buffer, log_repeat.c_str ());
+				writeRepeatCount ();
 
-					last_log_count = 0;
+				if (log_format == LOG_FORMAT_JSON)
+				{
+					char level[16];
+					snprintf (level, 16, "debug%d", debug_level);
+					writeRecord (level, NULL, 0, line, strlen (line));
+				}
+				else
+				{
+					fprintf (log_file, "%s%s DEBUG %d%s", getTimeStamp (), line_prefix, debug_level, line);
 				}
 
-				fprintf (log_file, "%s%s DEBUG %d%s", time_buffer, line_prefix, debug_level, line);
-
-				closeLogFile ();
+				flushLogFile ();
 			}
 		}
 	}
@@ -279,15 +562,15 @@ void Logger::debugx (uint8_t debug_level, unsigned char hex, bool end_line)
 		{
 			printf ("\n");
 		}
-		if (initLogFile() == 1)
+		// Hex dumps would break up the records of a structured log
+		if ((log_format == LOG_FORMAT_TEXT) && (initLogFile() == 1))
 		{
 			fprintf (log_file, "%02x ", hex);
 			if (end_line)
 			{
 				fprintf (log_file, "\n");
+				flushLogFile ();
 			}
-
-			closeLogFile ();
 		}
 	}
 
@@ -295,10 +578,277 @@ void Logger::debugx (uint8_t debug_level, unsigned char hex, bool end_line)
 }
 
 
+/**
+ * Returns the time prefix for a log line, only formatting it again once the second changes
+ */
+const char *Logger::getTimeStamp (void)
+{
+	struct timespec now;
+	clock_gettime (CLOCK_REALTIME, &now);
+
+	if (now.tv_sec != time_stamp_second)
+	{
+		struct tm now_tm;
+		gmtime_r (&now.tv_sec, &now_tm);
+		strftime (time_stamp, 21, "%Y/%m/%d %H:%M:%S ", &now_tm);
+		time_stamp_second = now.tv_sec;
+	}
+
+	return time_stamp;
+}
+
+
+/**
+ * Writes out how many times the last message repeated, if it did
+ */
+void Logger::writeRepeatCount (void)
+{
+	if (last_log_count > 0)
+	{
+		if (log_format == LOG_FORMAT_JSON)
+		{
+			char buffer[64];
+			int length = snprintf (buffer, 64, "(Last message repeated %d times.)", last_log_count);
+			writeRecord ("info", NULL, 0, buffer, length);
+		}
+		else
+		{
+			fprintf (log_file, "%s(Last message repeated %d times.)\n", getTimeStamp (), last_log_count);
+		}
+
+		last_log_count = 0;
+	}
+}
+
+
+/**
+ * Writes one JSON line holding the time, level, server, message id, direction and body
+ */
+void Logger::writeRecord (const char *level, const char *direction, int32_t msg_id, const char *body, size_t body_length)
+{
+	struct timespec monotonic;
+	clock_gettime (CLOCK_MONOTONIC, &monotonic);
+
+	// Log lines start with ": " and end with a new line which the record doesn't need
+	if ((direction == NULL) && (body_length >= 2) && (body[0] == ':') && (body[1] == ' '))
+	{
+		body += 2;
+		body_length -= 2;
+	}
+	if ((body_length > 0) && (body[body_length-1] == '\n'))
+	{
+		body_length--;
+	}
+
+	fprintf (log_file, "{\"time\":\"%.19s\",\"mono_ns\":%llu,\"level\":\"%s\",\"source\":", getTimeStamp (),
+		(unsigned long long)monotonic.tv_sec * 1000000000ULL + monotonic.tv_nsec, level);
+	writeJSONString (line_prefix, strlen (line_prefix));
+	if (!server_name.empty ())
+	{
+		fputs (",\"server\":", log_file);
+		writeJSONString (server_name.c_str (), server_name.size ());
+	}
+	if (direction != NULL)
+	{
+		fprintf (log_file, ",\"id\":%d,\"direction\":", msg_id);
+		writeJSONString (direction, strlen (direction));
+	}
+	fputs (",\"body\":", log_file);
+	writeJSONString (body, body_length);
+	fputs ("}\n", log_file);
+}
+
+
+/**
+ * Returns the length of the UTF-8 character at the start of text, or 0 if it isn't valid UTF-8
+ */
+static size_t validUTF8Length (const unsigned char *text, size_t length)
+{
+	// The range the second byte has to be in depends on the first, to rule out overlong
+	// encodings, surrogates and anything past U+10FFFF
+	unsigned char lead = text[0];
+	size_t sequence_length;
+	unsigned char second_low = 0x80;
+	unsigned char second_high = 0xBF;
+	if ((lead >= 0xC2) && (lead <= 0xDF))
+	{
+		sequence_length = 2;
+	}
+	else if ((lead >= 0xE0) && (lead <= 0xEF))
+	{
+		sequence_length = 3;
+		second_low = (lead == 0xE0) ? 0xA0 : 0x80;
+		second_high = (lead == 0xED) ? 0x9F : 0xBF;
+	}
+	else if ((lead >= 0xF0) && (lead <= 0xF4))
+	{
+		sequence_length = 4;
+		second_low = (lead == 0xF0) ? 0x90 : 0x80;
+		second_high = (lead == 0xF4) ? 0x8F : 0xBF;
+	}
+	else
+	{
+		return 0;
+	}
+
+	if ((length < sequence_length) || (text[1] < second_low) || (text[1] > second_high))
+	{
+		return 0;
+	}
+	for (size_t t = 2; t < sequence_length; t++)
+	{
+		if ((text[t] & 0xC0) != 0x80)
+		{
+			return 0;
+		}
+	}
+	return sequence_length;
+}
+
+
+/**
+ * Writes the given text as a quoted JSON string, escaping only the characters that need it. Bytes
+ * that aren't valid UTF-8, like Latin-1 player names, are escaped as the Latin-1 character they
+ * would be so the line stays valid JSON
+ */
+void Logger::writeJSONString (const char *text, size_t length)
+{
+	size_t run_start = 0;
+
+	fputc ('"', log_file);
+	for (size_t t = 0; t < length; t++)
+	{
+		unsigned char c = text[t];
+		if ((c >= 0x20) && (c < 0x80) && (c != '"') && (c != '\\'))
+		{
+			continue;
+		}
+
+		// Valid multi byte characters are written as they are
+		if (c >= 0x80)
+		{
+			size_t sequence_length = validUTF8Length ((const unsigned char *)&text[t], length - t);
+			if (sequence_length > 0)
+			{
+				t += sequence_length - 1;
+				continue;
+			}
+		}
+
+		// Write out the plain run before this character, then its escape
+		fwrite (&text[run_start], 1, t - run_start, log_file);
+		run_start = t + 1;
+		switch (c)
+		{
+			case '"':
+			{
+				fputs ("\\\"", log_file);
+			}
+			break;
+			case '\\':
+			{
+				fputs ("\\\\", log_file);
+			}
+			break;
+			case '\n':
+			{
+				fputs ("\\n", log_file);
+			}
+			break;
+			case '\r':
+			{
+				fputs ("\\r", log_file);
+			}
+			break;
+			case '\t':
+			{
+				fputs ("\\t", log_file);
+			}
+			break;
+			default:
+			{
+				fprintf (log_file, "\\u%04x", c);
+			}
+			break;
+		}
+	}
+	fwrite (&text[run_start], 1, length - run_start, log_file);
+	fputc ('"', log_file);
+}
+
+
+/**
+ * Pushes the written line out to the log file, and rotates it once it is full or old enough
+ */
+void Logger::flushLogFile (void)
+{
+	fflush (log_file);
+	log_file_size = ftell (log_file);
+
+	if (((max_log_size > 0) && (log_file_size >= max_log_size)) ||
+		((max_log_age > 0) && (time (NULL) - log_file_opened >= max_log_age)))
+	{
+		rotateLogFile ();
+	}
+}
+
+
 /**
  * Closes the log file
  */
 void Logger::closeLogFile (void)
 {
-	fclose (log_file);
+	if (log_file != NULL)
+	{
+		fclose (log_file);
+		log_file = NULL;
+	}
+}
+
+
+/**
+ * Moves each old log file up a number, drops the oldest and starts a new log file
+ */
+void Logger::rotateLogFile (void)
+{
+	char old_name[LOGGER_MAX_BUFFER];
+	char new_name[LOGGER_MAX_BUFFER];
+	const char *suffixes[2] = {"", ".gz"};
+
+	closeLogFile ();
+
+	// Let the last compression finish before its file is moved
+	if (compress_pid > 0)
+	{
+		waitpid (compress_pid, NULL, 0);
+		compress_pid = 0;
+	}
+
+	// Shift the numbered files up, compressed or not
+	for (uint8_t s = 0; s < 2; s++)
+	{
+		snprintf (old_name, LOGGER_MAX_BUFFER, "%s.%d%s", log_file_name.c_str (), max_log_files, suffixes[s]);
+		unlink (old_name);
+		for (int t = max_log_files - 1; t >= 1; t--)
+		{
+			snprintf (old_name, LOGGER_MAX_BUFFER, "%s.%d%s", log_file_name.c_str (), t, suffixes[s]);
+			snprintf (new_name, LOGGER_MAX_BUFFER, "%s.%d%s", log_file_name.c_str (), t + 1, suffixes[s]);
+			rename (old_name, new_name);
+		}
+	}
+	snprintf (new_name, LOGGER_MAX_BUFFER, "%s.1", log_file_name.c_str ());
+	rename (log_file_name.c_str (), new_name);
+
+	// Compress the closed file in the background
+	if (compress_logs)
+	{
+		compress_pid = fork ();
+		if (compress_pid == 0)
+		{
+			execlp ("gzip", "gzip", "-f", new_name, (char *)NULL);
+			_exit (1);
+		}
+	}
+
+	log_file_size = 0;
 }
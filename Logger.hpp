@@ -1,7 +1,13 @@
 #ifndef	_LOGGER_H
 #define _LOGGER_H
 
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 
 // Defines the max buffer size of the Logger
 #define LOGGER_MAX_BUFFER	1024
@@ -12,6 +18,10 @@
 #define DEBUG_STANDARD		2
 #define DEBUG_DETAILED		3
 
+// Defines the log file formats
+#define LOG_FORMAT_TEXT		0
+#define LOG_FORMAT_JSON		1
+
 // Define the Logger class
 class Logger;
 
@@ -27,10 +37,32 @@ private:
 	std::string last_log_line;
 	uint32_t last_log_count;
 	pthread_mutex_t log_mutex;
+	uint64_t log_file_size;
+	time_t log_file_opened;
+	uint64_t max_log_size;
+	uint32_t max_log_age;
+	uint8_t max_log_files;
+	bool compress_logs;
+	pid_t compress_pid;
+	uint8_t log_format;
+	std::string server_name;
+	time_t time_stamp_second;
+	char time_stamp[21];
+	int32_t reply_id;
+	bool reply_open;
+	bool reply_line_start;
 
 	// Private methods
 	int initLogFile (void);
+	void flushLogFile (void);
 	void closeLogFile (void);
+	void rotateLogFile (void);
+	const char *getTimeStamp (void);
+	void writeRepeatCount (void);
+	void writeRecord (const char *level, const char *direction, int32_t msg_id, const char *body, size_t body_length);
+	void writeJSONString (const char *text, size_t length);
+	void writeScreen (struct iovec *line, int count);
+	void breakReply (void);
 
 public:
 	// Constructors and destructor
@@ -42,8 +74,15 @@ public:
 	void setLogFileLocation (const char *log_file_location);
 	void setLinePrefix (const char *new_line_prefix);
 	void setDebugLevel (uint8_t new_debug_level);
+	uint8_t getDebugLevel (void);
+	void setLogFormat (uint8_t new_log_format);
+	void setServerName (const char *new_server_name);
+	void setRotation (uint64_t max_size, uint32_t max_age, uint8_t max_files, bool compress);
 	void logf (const char *format, ...);
 	void log (const char *line);
+	void logMessage (const char *direction, int32_t msg_id, const char *body, size_t body_length);
+	void logReplyPart (const char *direction, int32_t msg_id, const char *body, size_t body_length);
+	void endReply (int32_t msg_id);
 	void logx (unsigned char hex, bool end_line);
 	void debugf (uint8_t debug_level, const char *format, ...);
 	void debug (uint8_t debug_level, const char *line);
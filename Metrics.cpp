@@ -0,0 +1,206 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "Metrics.hpp"
+
+// Every thread records into its own buffer, the list is only locked when a thread first records
+__thread struct MetricBuffer *metric_buffer = NULL;
+static std::vector<struct MetricBuffer *> metric_buffers;
+static pthread_mutex_t metric_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int64_t metric_gauges[METRIC_GAUGES];
+
+// Used to serve the metrics over a Unix socket
+static int metrics_sock = -1;
+static pthread_t metrics_thread;
+static void *metricsThread (void *);
+
+/**
+ * Creates the calling threads buffer, the first time it records anything
+ */
+struct MetricBuffer *metricThreadBuffer (void)
+{
+	if (metric_buffer == NULL)
+	{
+		metric_buffer = (struct MetricBuffer *) calloc (1, sizeof (struct MetricBuffer));
+
+		pthread_mutex_lock (&metric_mutex);
+		metric_buffers.push_back (metric_buffer);
+		pthread_mutex_unlock (&metric_mutex);
+	}
+	return metric_buffer;
+}
+
+
+/**
+ * Adds a request latency to the calling threads histogram
+ */
+void metricObserveLatency (uint64_t latency_us)
+{
+	static const uint64_t bounds[METRIC_LATENCY_BUCKETS] = METRIC_LATENCY_BOUNDS;
+	struct MetricBuffer *buffer = (metric_buffer != NULL) ? metric_buffer : metricThreadBuffer ();
+
+	uint8_t bucket = 0;
+	while ((bucket < METRIC_LATENCY_BUCKETS) && (latency_us > bounds[bucket]))
+	{
+		bucket++;
+	}
+	__atomic_store_n (&buffer->latency_buckets[bucket], buffer->latency_buckets[bucket] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n (&buffer->latency_sum_us, buffer->latency_sum_us + latency_us, __ATOMIC_RELAXED);
+	__atomic_store_n (&buffer->latency_count, buffer->latency_count + 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Sets a gauge to the given value
+ */
+void metricSetGauge (uint8_t gauge, int64_t value)
+{
+	__atomic_store_n (&metric_gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Adds up every threads metrics and writes them out in the Prometheus text format
+ */
+void metricsWrite (FILE *metrics_file)
+{
+	static const uint64_t bounds[METRIC_LATENCY_BUCKETS] = METRIC_LATENCY_BOUNDS;
+	uint64_t counters[METRIC_COUNTERS];
+	uint64_t latency_buckets[METRIC_LATENCY_BUCKETS + 1];
+	uint64_t latency_sum_us = 0;
+	uint64_t latency_count = 0;
+
+	memset (counters, 0, sizeof (counters));
+	memset (latency_buckets, 0, sizeof (latency_buckets));
+
+	pthread_mutex_lock (&metric_mutex);
+	for (size_t b = 0; b < metric_buffers.size (); b++)
+	{
+		struct MetricBuffer *buffer = metric_buffers[b];
+		for (uint8_t t = 0; t < METRIC_COUNTERS; t++)
+		{
+			counters[t] += __atomic_load_n (&buffer->counters[t], __ATOMIC_RELAXED);
+		}
+		for (uint8_t t = 0; t <= METRIC_LATENCY_BUCKETS; t++)
+		{
+			latency_buckets[t] += __atomic_load_n (&buffer->latency_buckets[t], __ATOMIC_RELAXED);
+		}
+		latency_sum_us += __atomic_load_n (&buffer->latency_sum_us, __ATOMIC_RELAXED);
+		latency_count += __atomic_load_n (&buffer->latency_count, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock (&metric_mutex);
+
+	fprintf (metrics_file, "# HELP ssrcon_connects_total Connections made to the RCON server.\n# TYPE ssrcon_connects_total counter\n");
+	fprintf (metrics_file, "ssrcon_connects_total %llu\n", (unsigned long long)counters[METRIC_CONNECTS]);
+	fprintf (metrics_file, "# HELP ssrcon_reconnects_total Connections made after the first.\n# TYPE ssrcon_reconnects_total counter\n");
+	fprintf (metrics_file, "ssrcon_reconnects_total %llu\n", (unsigned long long)counters[METRIC_RECONNECTS]);
+	fprintf (metrics_file, "# HELP ssrcon_auth_failures_total Attempts to authorise that failed.\n# TYPE ssrcon_auth_failures_total counter\n");
+	fprintf (metrics_file, "ssrcon_auth_failures_total %llu\n", (unsigned long long)counters[METRIC_AUTH_FAILURES]);
+	fprintf (metrics_file, "# HELP ssrcon_read_errors_total Errors while reading messages, by error code.\n# TYPE ssrcon_read_errors_total counter\n");
+	for (uint8_t t = 0; t < 6; t++)
+	{
+		fprintf (metrics_file, "ssrcon_read_errors_total{code=\"-%d\"} %llu\n", t + 1, (unsigned long long)counters[METRIC_READ_ERRORS + t]);
+	}
+	fprintf (metrics_file, "# HELP ssrcon_frames_total Messages sent and received.\n# TYPE ssrcon_frames_total counter\n");
+	fprintf (metrics_file, "ssrcon_frames_total{direction=\"in\"} %llu\n", (unsigned long long)counters[METRIC_FRAMES_IN]);
+	fprintf (metrics_file, "ssrcon_frames_total{direction=\"out\"} %llu\n", (unsigned long long)counters[METRIC_FRAMES_OUT]);
+	fprintf (metrics_file, "# HELP ssrcon_bytes_total Bytes sent and received.\n# TYPE ssrcon_bytes_total counter\n");
+	fprintf (metrics_file, "ssrcon_bytes_total{direction=\"in\"} %llu\n", (unsigned long long)counters[METRIC_BYTES_IN]);
+	fprintf (metrics_file, "ssrcon_bytes_total{direction=\"out\"} %llu\n", (unsigned long long)counters[METRIC_BYTES_OUT]);
+	fprintf (metrics_file, "# HELP ssrcon_in_flight_requests Commands sent that have not had a reply yet.\n# TYPE ssrcon_in_flight_requests gauge\n");
+	fprintf (metrics_file, "ssrcon_in_flight_requests %lld\n", (long long)__atomic_load_n (&metric_gauges[METRIC_IN_FLIGHT], __ATOMIC_RELAXED));
+	fprintf (metrics_file, "# HELP ssrcon_output_queue_depth Replies waiting to be written out.\n# TYPE ssrcon_output_queue_depth gauge\n");
+	fprintf (metrics_file, "ssrcon_output_queue_depth %lld\n", (long long)__atomic_load_n (&metric_gauges[METRIC_QUEUE_DEPTH], __ATOMIC_RELAXED));
+
+	// Prometheus buckets are cumulative
+	fprintf (metrics_file, "# HELP ssrcon_request_latency_seconds Time from sending a command to its first reply.\n# TYPE ssrcon_request_latency_seconds histogram\n");
+	uint64_t cumulative = 0;
+	for (uint8_t t = 0; t < METRIC_LATENCY_BUCKETS; t++)
+	{
+		cumulative += latency_buckets[t];
+		fprintf (metrics_file, "ssrcon_request_latency_seconds_bucket{le=\"%g\"} %llu\n", bounds[t] / 1000000.0, (unsigned long long)cumulative);
+	}
+	cumulative += latency_buckets[METRIC_LATENCY_BUCKETS];
+	fprintf (metrics_file, "ssrcon_request_latency_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+	fprintf (metrics_file, "ssrcon_request_latency_seconds_sum %.6f\n", latency_sum_us / 1000000.0);
+	fprintf (metrics_file, "ssrcon_request_latency_seconds_count %llu\n", (unsigned long long)latency_count);
+}
+
+
+/**
+ * Starts a thread serving the metrics to anything that connects to the given Unix socket,
+ * returns 1 on success or -1 if the socket couldn't be set up
+ */
+int metricsServe (const char *socket_path)
+{
+	struct sockaddr_un address;
+	if (strlen (socket_path) >= sizeof (address.sun_path))
+	{
+		return -1;
+	}
+
+	memset (&address, 0, sizeof (address));
+	address.sun_family = AF_UNIX;
+	strcpy (address.sun_path, socket_path);
+
+	// Replace a socket left behind by an earlier run
+	unlink (socket_path);
+	metrics_sock = socket (AF_UNIX, SOCK_STREAM, 0);
+	if ((metrics_sock < 0) ||
+		(bind (metrics_sock, (struct sockaddr *) &address, sizeof (address)) < 0) ||
+		(listen (metrics_sock, 8) < 0))
+	{
+		if (metrics_sock >= 0)
+		{
+			close (metrics_sock);
+			metrics_sock = -1;
+		}
+		return -1;
+	}
+
+	pthread_create (&metrics_thread, NULL, metricsThread, NULL);
+	pthread_detach (metrics_thread);
+	return 1;
+}
+
+
+/**
+ * Writes the metrics to each connection and closes it
+ */
+static void *metricsThread (void *)
+{
+	while (true)
+	{
+		int client = accept (metrics_sock, NULL, NULL);
+		if (client < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+
+		FILE *client_file = fdopen (client, "w");
+		if (client_file != NULL)
+		{
+			metricsWrite (client_file);
+			fclose (client_file);
+		}
+		else
+		{
+			close (client);
+		}
+	}
+
+	return 0;
+}
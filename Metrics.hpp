@@ -0,0 +1,60 @@
+#ifndef	_METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Counters, each thread keeps its own copy which are added up when the metrics are read
+#define METRIC_CONNECTS			0
+#define METRIC_RECONNECTS		1
+#define METRIC_AUTH_FAILURES	2
+#define METRIC_FRAMES_IN		3
+#define METRIC_FRAMES_OUT		4
+#define METRIC_BYTES_IN			5
+#define METRIC_BYTES_OUT		6
+#define METRIC_READ_ERRORS		7	// One counter for each of the -1 to -6 read errors, in order
+#define METRIC_RECV_FAILED		7
+#define METRIC_SERVER_CLOSED	8
+#define METRIC_BAD_SIZE			9
+#define METRIC_BAD_ID			10
+#define METRIC_BAD_TYPE			11
+#define METRIC_BAD_END			12
+#define METRIC_COUNTERS			13
+
+// Gauges, set directly as they only have one writer
+#define METRIC_IN_FLIGHT		0
+#define METRIC_QUEUE_DEPTH		1
+#define METRIC_GAUGES			2
+
+// The upper bounds of the request latency histogram in microseconds
+#define METRIC_LATENCY_BUCKETS	10
+#define METRIC_LATENCY_BOUNDS	{1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 5000000}
+
+// The counters and latency histogram recorded by one thread
+struct MetricBuffer
+{
+	uint64_t counters[METRIC_COUNTERS];
+	uint64_t latency_buckets[METRIC_LATENCY_BUCKETS + 1];
+	uint64_t latency_sum_us;
+	uint64_t latency_count;
+};
+
+extern __thread struct MetricBuffer *metric_buffer;
+
+struct MetricBuffer *metricThreadBuffer (void);
+void metricObserveLatency (uint64_t latency_us);
+void metricSetGauge (uint8_t gauge, int64_t value);
+void metricsWrite (FILE *metrics_file);
+int metricsServe (const char *socket_path);
+
+/**
+ * Adds to one of the calling threads counters, the owning thread is the only writer so no lock
+ * or atomic read-modify-write is needed, the store is atomic so a reader never sees a torn value
+ */
+static inline void metricAdd (uint8_t counter, uint64_t value)
+{
+	struct MetricBuffer *buffer = (metric_buffer != NULL) ? metric_buffer : metricThreadBuffer ();
+	__atomic_store_n (&buffer->counters[counter], buffer->counters[counter] + value, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "RCONCodec.hpp"
+
+/**
+ * Writes a message into out, which must have room for body_length + RCON_FRAME_OVERHEAD bytes,
+ * returns how many bytes were written
+ */
+uint32_t rconEncodeFrame (uint8_t *out, const char *body, uint32_t body_length, int32_t msg_id, int32_t msg_type)
+{
+	int32_t data_size = body_length + RCON_MIN_DATA_SIZE;
+
+	// Adds the message size, id and type
+	memcpy (&out[0], &data_size, sizeof (int32_t));
+	memcpy (&out[4], &msg_id, sizeof (int32_t));
+	memcpy (&out[8], &msg_type, sizeof (int32_t));
+
+	// Adds the message body, its null terminator and the empty string
+	memcpy (&out[12], body, body_length);
+	out[12 + body_length] = 0x00;
+	out[13 + body_length] = 0x00;
+
+	return body_length + RCON_FRAME_OVERHEAD;
+}
+
+
+/**
+ * Pulls the first message out of the data, returns its size once all of it is there, 0 if more
+ * is needed, RCON_DECODE_BAD_SIZE if the size is below RCON_MIN_DATA_SIZE or above max_data_size
+ * or RCON_DECODE_BAD_END if it doesn't end in two nulls. frame->data_size is filled in as soon as
+ * the size is there, so on RCON_DECODE_BAD_END the message can still be skipped
+ */
+int rconDecodeFrame (const uint8_t *data, uint32_t length, int32_t max_data_size, struct RCONFrame *frame)
+{
+	// Wait for the size of the message
+	if (length < 4)
+	{
+		return RCON_DECODE_INCOMPLETE;
+	}
+	memcpy (&frame->data_size, data, sizeof (int32_t));
+
+	// The size comes from the server, so check it before it's used for anything
+	if ((frame->data_size < RCON_MIN_DATA_SIZE) || (frame->data_size > max_data_size))
+	{
+		return RCON_DECODE_BAD_SIZE;
+	}
+
+	// Wait for the rest of the message
+	if (length - 4 < (uint32_t)frame->data_size)
+	{
+		return RCON_DECODE_INCOMPLETE;
+	}
+
+	// Read the message id, type and body
+	const uint8_t *message = &data[4];
+	memcpy (&frame->msg_id, message, sizeof (int32_t));
+	memcpy (&frame->msg_type, &message[4], sizeof (int32_t));
+	frame->body = (const char *)&message[8];
+	frame->body_length = frame->data_size - RCON_MIN_DATA_SIZE;
+
+	// Check the body is followed by its null terminator and the empty string
+	if ((message[frame->data_size - 2] != 0x00) || (message[frame->data_size - 1] != 0x00))
+	{
+		return RCON_DECODE_BAD_END;
+	}
+
+	return frame->data_size;
+}
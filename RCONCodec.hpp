@@ -0,0 +1,39 @@
+#ifndef	_RCONCODEC_H
+#define _RCONCODEC_H
+
+#include <stdint.h>
+
+// How many bytes of messages are buffered, the largest message most servers send fits in it
+#define RCON_BUFFER_SIZE	65536
+
+// Message types
+#define SERVERDATA_AUTH				3
+#define SERVERDATA_AUTH_RESPONSE	2
+#define SERVERDATA_EXECCOMMAND		2
+#define SERVERDATA_RESPONSE_VALUE	0
+
+// The bytes around a message body, the size, id and type before it and the two nulls after it
+#define RCON_FRAME_OVERHEAD	14
+
+// The smallest message size, an id, a type and the two nulls with an empty body
+#define RCON_MIN_DATA_SIZE	10
+
+// Results from rconDecodeFrame that aren't a message size
+#define RCON_DECODE_INCOMPLETE	0
+#define RCON_DECODE_BAD_SIZE	-3
+#define RCON_DECODE_BAD_END	-6
+
+// A message pulled out of a buffer, the body points into the buffer it was decoded from
+struct RCONFrame
+{
+	int32_t data_size;
+	int32_t msg_id;
+	int32_t msg_type;
+	const char *body;
+	uint32_t body_length;
+};
+
+uint32_t rconEncodeFrame (uint8_t *out, const char *body, uint32_t body_length, int32_t msg_id, int32_t msg_type);
+int rconDecodeFrame (const uint8_t *data, uint32_t length, int32_t max_data_size, struct RCONFrame *frame);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef	_RCONDIALECT_H
+#define _RCONDIALECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "RCONCodec.hpp"
+
+// The dialects a session can be created with
+#define RCON_DIALECT_SOURCE	0
+#define RCON_DIALECT_MINECRAFT	1
+#define RCON_DIALECT_FACTORIO	2
+
+// Each dialect describes how a game bends the RCON protocol, the session is built once per dialect
+// so these are all fixed when it's compiled:
+//   list_command - the command that lists the servers commands for completion, or NULL if it has none
+//   version_command - the command whose reply tells one build of the server from another, or NULL if it has none
+//   max_command - the longest command body the server accepts
+//   buffer_size - how many bytes each session buffers from the server, which caps max_frame
+//   max_frame - the largest message size the server sends, anything bigger is an error
+//   auth_response_value - the server sends an empty SERVERDATA_RESPONSE_VALUE before SERVERDATA_AUTH_RESPONSE
+//   terminator_echo - the end of a reply is found by sending an empty SERVERDATA_RESPONSE_VALUE after
+//     the command, the server answers it once it has sent the whole reply
+//   fragment_size - replies are split every this many UTF-16 characters, so a message with fewer
+//     ends the reply, or 0 if every reply is a single message
+//   fragment_timeout - how many milliseconds a reply whose last message was full waits for another
+//     before it's taken as complete, as one that splits exactly has nothing shorter to end it
+
+// Source engine servers split long replies with nothing marking the last part, but do answer in order
+struct SourceDialect
+{
+	static const char *name (void) { return "Source"; }
+	static const char *list_command (void) { return "cvarlist"; }
+	static const char *version_command (void) { return "version"; }
+	static const uint32_t max_command = 4086;
+	static const uint32_t buffer_size = RCON_BUFFER_SIZE;
+	static const int32_t max_frame = RCON_BUFFER_SIZE - 4;
+	static const bool auth_response_value = true;
+	static const bool terminator_echo = true;
+	static const uint32_t fragment_size = 0;
+	static const uint32_t fragment_timeout = 0;
+};
+
+// Minecraft servers split replies every 4096 characters before encoding them as UTF-8, so a message
+// can be up to three times that in bytes, and they don't echo unknown message types
+struct MinecraftDialect
+{
+	static const char *name (void) { return "Minecraft"; }
+	static const char *list_command (void) { return NULL; }
+	static const char *version_command (void) { return NULL; }
+	static const uint32_t max_command = 1446;
+	static const uint32_t buffer_size = RCON_BUFFER_SIZE;
+	static const int32_t max_frame = 4096 * 3 + 10;
+	static const bool auth_response_value = false;
+	static const bool terminator_echo = false;
+	static const uint32_t fragment_size = 4096;
+	static const uint32_t fragment_timeout = 500;
+};
+
+// Factorio servers send every reply as one message, so the buffer is big enough for long script
+// output, a reply over 4MB is still taken as a broken message and closes the connection
+struct FactorioDialect
+{
+	static const char *name (void) { return "Factorio"; }
+	static const char *list_command (void) { return NULL; }
+	static const char *version_command (void) { return "/version"; }
+	static const uint32_t max_command = RCON_BUFFER_SIZE - 14;
+	static const uint32_t buffer_size = 4 * 1024 * 1024;
+	static const int32_t max_frame = 4 * 1024 * 1024 - 4;
+	static const bool auth_response_value = false;
+	static const bool terminator_echo = false;
+	static const uint32_t fragment_size = 0;
+	static const uint32_t fragment_timeout = 0;
+};
+
+#endif
@@ -0,0 +1,740 @@
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "RCONSession.hpp"
+#include "RCONCodec.hpp"
+#include "Trace.hpp"
+#include "Metrics.hpp"
+
+/**
+ * Returns a steady time in microseconds
+ */
+static uint64_t sessionMicros (void)
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+
+/**
+ * Returns how many UTF-16 characters some UTF-8 text holds, every byte that starts a character counts
+ * once and a four byte character counts twice, as it needs a surrogate pair
+ */
+static uint32_t utf16Length (const char *text, uint32_t length)
+{
+	uint32_t characters = 0;
+	for (uint32_t t = 0; t < length; t++)
+	{
+		uint8_t byte = (uint8_t)text[t];
+		if ((byte & 0xC0) != 0x80)
+		{
+			characters += (byte >= 0xF0) ? 2 : 1;
+		}
+	}
+	return characters;
+}
+
+
+/**
+ * Creates an unconnected RCON session that logs through the given logger
+ */
+RCONSession::RCONSession (Logger *session_logger)
+{
+	logger = session_logger;
+	sock = -1;
+	state = RCON_CONNECT;
+	last_id = 0;
+	has_connected = false;
+	reply_callback = NULL;
+	reply_user_data = NULL;
+	complete_callback = NULL;
+	complete_user_data = NULL;
+	auth_callback = NULL;
+	auth_user_data = NULL;
+	auth_result = 0;
+	buffer = NULL;
+	buffer_size = 0;
+	buffer_length = 0;
+	buffer_start = 0;
+}
+
+
+/**
+ * Creates an unconnected session for the given dialect
+ */
+template <class Dialect>
+RCONSessionT<Dialect>::RCONSessionT (Logger *session_logger) : RCONSession (session_logger)
+{
+	completed_id = 0;
+	auth_expected_type = SERVERDATA_AUTH_RESPONSE;
+	auth_deadline = 0;
+	fragment_id = 0;
+	fragment_deadline = 0;
+	buffer_size = Dialect::buffer_size;
+	buffer = new uint8_t[buffer_size];
+}
+
+
+/**
+ * Closes the connection and destroys the session
+ */
+RCONSession::~RCONSession ()
+{
+	if (sock != -1)
+	{
+		close (sock);
+		sock = -1;
+	}
+	delete[] buffer;
+}
+
+
+/**
+ * Creates an unconnected session for one of the RCON_DIALECT values, or NULL if it's unknown
+ */
+RCONSession *RCONSession::create (Logger *session_logger, uint8_t dialect)
+{
+	switch (dialect)
+	{
+		case (RCON_DIALECT_SOURCE):
+		{
+			return new SourceRCONSession (session_logger);
+		}
+		case (RCON_DIALECT_MINECRAFT):
+		{
+			return new MinecraftRCONSession (session_logger);
+		}
+		case (RCON_DIALECT_FACTORIO):
+		{
+			return new FactorioRCONSession (session_logger);
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * Connects to the given server and port, returns 1 on success
+ */
+int RCONSession::connectServer (const char *address, int port)
+{
+	struct sockaddr_in serv_addr;
+	hostent *server;
+
+	// Create socket
+	sock = socket (AF_INET, SOCK_STREAM, 0);
+	TRACE_BEGIN ("dns");
+	server = gethostbyname (address);
+	TRACE_END ("dns");
+	if ((sock >= 0) && (server != NULL))
+	{
+		// Sets up the server address
+		bzero ((char *) &serv_addr, sizeof (serv_addr));
+		serv_addr.sin_family = AF_INET;
+		bcopy ((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr, server->h_length);
+		serv_addr.sin_port = htons (port);
+
+		// Connect
+		TRACE_BEGIN ("connect");
+		int return_value = ::connect (sock, (struct sockaddr *) &serv_addr, sizeof (serv_addr));
+		TRACE_END ("connect");
+		if (return_value >= 0)
+		{
+			metricAdd ((has_connected) ? METRIC_RECONNECTS : METRIC_CONNECTS, 1);
+			has_connected = true;
+			state = RCON_AUTH;
+			logger->log (": Connected to the RCON server.\n");
+			return 1;
+		}
+		else
+		{
+			logger->logf (": Unable to get the server host: %s.\n", strerror(errno));
+		}
+	}
+	else
+	{
+		logger->logf (": Unable to open a socket, or find the server: %s.\n", strerror(errno));
+	}
+
+	if (sock >= 0)
+	{
+		close (sock);
+		sock = -1;
+	}
+	return -1;
+}
+
+
+/**
+ * Sends the password and waits for the server to accept it, returns 1 once authorised,
+ * 0 if the password should be asked for again, or a negative value if the session was closed
+ */
+template <class Dialect>
+int RCONSessionT<Dialect>::authenticate (const char *password)
+{
+	int return_value = beginAuthenticate (password);
+	if (return_value < 0)
+	{
+		return return_value;
+	}
+
+	// Wait on the socket until poll has seen the auth replies or timed out
+	TRACE_BEGIN ("wait for auth");
+	while (state == RCON_AUTH_WAIT)
+	{
+		struct pollfd poll_fd;
+		poll_fd.fd = sock;
+		poll_fd.events = POLLIN;
+		poll_fd.revents = 0;
+		::poll (&poll_fd, 1, 100);
+		poll ();
+	}
+	TRACE_END ("wait for auth");
+
+	return auth_result;
+}
+
+
+/**
+ * Sends the password without waiting, poll then handles the servers replies and calls the
+ * auth callback with the result. Returns 0 once sent or a negative value if it couldn't be
+ */
+template <class Dialect>
+int RCONSessionT<Dialect>::beginAuthenticate (const char *password)
+{
+	if (sendMessage (password, RCON_AUTH_ID, SERVERDATA_AUTH) != 0)
+	{
+		finishAuth (-1);
+		return -1;
+	}
+
+	// Some servers send an empty response value before the auth response
+	auth_expected_type = (Dialect::auth_response_value) ? SERVERDATA_RESPONSE_VALUE : SERVERDATA_AUTH_RESPONSE;
+	auth_deadline = sessionMicros () + RCON_AUTH_TIMEOUT * 100000ULL;
+	fragment_id = 0;
+	state = RCON_AUTH_WAIT;
+	return 0;
+}
+
+
+/**
+ * Checks a message received while waiting for the server to accept the password
+ */
+template <class Dialect>
+void RCONSessionT<Dialect>::checkAuthFrame (int32_t msg_id, int32_t msg_type)
+{
+	if (auth_expected_type == SERVERDATA_RESPONSE_VALUE)
+	{
+		if ((msg_id != RCON_AUTH_ID) || (msg_type != SERVERDATA_RESPONSE_VALUE))
+		{
+			metricAdd ((msg_id != RCON_AUTH_ID) ? METRIC_BAD_ID : METRIC_BAD_TYPE, 1);
+			logger->logf (": Error, server did not respond to SERVERDATA_AUTH command with a valid SERVERDATA_RESPONSE_VALUE first, disconnecting.\n");
+			state = RCON_CLOSE;
+			finishAuth ((msg_id != RCON_AUTH_ID) ? RCON_ERROR_ID : RCON_ERROR_TYPE);
+			return;
+		}
+
+		// Wait for auth response
+		logger->debug (DEBUG_MINIMAL, ": ID OK.\n");
+		auth_expected_type = SERVERDATA_AUTH_RESPONSE;
+		auth_deadline = sessionMicros () + RCON_AUTH_TIMEOUT * 100000ULL;
+		return;
+	}
+
+	if (msg_type != SERVERDATA_AUTH_RESPONSE)
+	{
+		metricAdd (METRIC_BAD_TYPE, 1);
+		logger->logf (": Error, server did not respond with a valid SERVERDATA_AUTH_RESPONSE, disconnecting.\n");
+		state = RCON_CLOSE;
+		finishAuth (RCON_ERROR_TYPE);
+	}
+	else if (msg_id != RCON_AUTH_ID)
+	{
+		// This should trigger if the password was wrong
+		metricAdd (METRIC_BAD_ID, 1);
+		logger->logf (": Error, server reponded with a different ID, your password may be wrong.\n");
+		state = RCON_AUTH;
+		finishAuth (0);
+	}
+	else
+	{
+		logger->debug (DEBUG_MINIMAL, ": ID OK.\n");
+		state = RCON_RUNNING;
+		finishAuth (1);
+	}
+}
+
+
+/**
+ * Sends a command to the server, returns the id its replies will carry or -1 on failure
+ */
+template <class Dialect>
+int32_t RCONSessionT<Dialect>::exec (const std::string &command)
+{
+	if (command.size () > Dialect::max_command)
+	{
+		logger->logf (": Command is %u bytes, longer than the %u a %s server accepts.\n",
+			(uint32_t)command.size (), (uint32_t)Dialect::max_command, Dialect::name ());
+		return -1;
+	}
+
+	// The terminator goes out in the same write, so finding the end of the reply costs no extra wait
+	last_id = (last_id + 1) & (RCON_TERMINATOR_FLAG - 1);
+	std::string frames;
+	appendFrame (frames, command, last_id, SERVERDATA_EXECCOMMAND);
+	if (Dialect::terminator_echo)
+	{
+		appendFrame (frames, "", last_id | RCON_TERMINATOR_FLAG, SERVERDATA_RESPONSE_VALUE);
+	}
+	if (sendFrames (frames, (Dialect::terminator_echo) ? 2 : 1, command) != 0)
+	{
+		return -1;
+	}
+	return last_id;
+}
+
+
+/**
+ * Handles every reply waiting on the socket without blocking, returns how many were
+ * handed to the reply callback or a negative value if the session was closed
+ */
+template <class Dialect>
+int RCONSessionT<Dialect>::poll (void)
+{
+	int replies = 0;
+	bool received = false;
+	int32_t msg_id;
+	int32_t msg_type;
+	const char *body;
+	uint32_t body_length;
+
+	int return_value = readFrame (&msg_id, &msg_type, &body, &body_length);
+	while (return_value != 0)
+	{
+		if (state == RCON_AUTH_WAIT)
+		{
+			// Anything the server sends before accepting the password is part of the auth
+			if (return_value > 0)
+			{
+				checkAuthFrame (msg_id, msg_type);
+			}
+			else
+			{
+				logger->logf (": Error, server did not respond to SERVERDATA_AUTH command with a valid reply, disconnecting.\n");
+				state = RCON_CLOSE;
+				finishAuth (return_value);
+				return return_value;
+			}
+		}
+		else if (return_value > 0)
+		{
+			received = true;
+			if ((Dialect::terminator_echo) && (msg_type == SERVERDATA_RESPONSE_VALUE) && (msg_id > 0) && ((msg_id & RCON_TERMINATOR_FLAG) != 0))
+			{
+				// The server answers the terminator once, or twice on some versions, after the whole reply
+				int32_t command_id = msg_id & (RCON_TERMINATOR_FLAG - 1);
+				if (command_id != completed_id)
+				{
+					completed_id = command_id;
+					completeReply (command_id);
+				}
+			}
+			else if (msg_type == SERVERDATA_RESPONSE_VALUE)
+			{
+				// Replies come back in order, so one to a later command ends a reply left waiting on a full message
+				if ((fragment_id != 0) && (msg_id != fragment_id))
+				{
+					completeReply (fragment_id);
+					fragment_id = 0;
+				}
+
+				TRACE_INSTANT ("reply", msg_id);
+				if (reply_callback != NULL)
+				{
+					reply_callback (reply_user_data, msg_id, body, body_length);
+				}
+				replies++;
+
+				// Without a terminator the reply ends with the first message that isn't full, or once a
+				// full one has gone unfollowed for fragment_timeout
+				if ((!Dialect::terminator_echo) && ((Dialect::fragment_size == 0) || (utf16Length (body, body_length) < Dialect::fragment_size)))
+				{
+					fragment_id = 0;
+					completeReply (msg_id);
+				}
+				else if (!Dialect::terminator_echo)
+				{
+					fragment_id = msg_id;
+					fragment_deadline = sessionMicros () + Dialect::fragment_timeout * 1000ULL;
+				}
+			}
+			else
+			{
+				metricAdd (METRIC_BAD_TYPE, 1);
+				logger->log (": Reply message type did not match expected type.\n");
+			}
+		}
+		else if (state == RCON_CLOSE)
+		{
+			return return_value;
+		}
+
+		return_value = readFrame (&msg_id, &msg_type, &body, &body_length);
+	}
+
+	// A server that holds back the small terminator echo until its last message is acknowledged would
+	// wait 40ms on our delayed ack, so acknowledge straight away once everything that arrived has been
+	// read and the echo is still to come. The kernel only sends a few quick acks each time it's set,
+	// so once per command isn't enough for replies of many messages
+	if ((Dialect::terminator_echo) && (received) && (state == RCON_RUNNING) && (completed_id != last_id))
+	{
+		int quick_ack = 1;
+		setsockopt (sock, IPPROTO_TCP, TCP_QUICKACK, &quick_ack, sizeof (quick_ack));
+	}
+
+	// Finish a reply that split exactly into full messages once nothing more has come for it
+	if ((fragment_id != 0) && (sessionMicros () > fragment_deadline))
+	{
+		completeReply (fragment_id);
+		fragment_id = 0;
+	}
+
+	// Give up on the auth if the server is taking too long
+	if ((state == RCON_AUTH_WAIT) && (sessionMicros () > auth_deadline))
+	{
+		logger->logf (": Warning, timed out while waiting for %s.\n",
+			(auth_expected_type == SERVERDATA_RESPONSE_VALUE) ? "SERVERDATA_RESPONSE_VALUE" : "SERVERDATA_AUTH_RESPONSE");
+		state = RCON_AUTH;
+		finishAuth (0);
+	}
+
+	return replies;
+}
+
+
+/**
+ * Tells the complete callback a command has its whole reply
+ */
+template <class Dialect>
+void RCONSessionT<Dialect>::completeReply (int32_t msg_id)
+{
+	TRACE_INSTANT ("reply complete", msg_id);
+	if (complete_callback != NULL)
+	{
+		complete_callback (complete_user_data, msg_id);
+	}
+}
+
+
+/**
+ * Closes the connection, leaving the session ready to connect again
+ */
+void RCONSession::disconnect (void)
+{
+	if (sock != -1)
+	{
+		close (sock);
+		sock = -1;
+	}
+
+	// Drop anything left over from the old connection
+	buffer_length = 0;
+	buffer_start = 0;
+	state = RCON_CONNECT;
+}
+
+
+/**
+ * Send an RCON Message
+ */
+int RCONSession::sendMessage (const std::string &msg_body, int32_t msg_id, int32_t msg_type)
+{
+	std::string frames;
+	appendFrame (frames, msg_body, msg_id, msg_type);
+	return sendFrames (frames, 1, msg_body);
+}
+
+
+/**
+ * Adds an RCON message to the end of frames
+ */
+void RCONSession::appendFrame (std::string &frames, const std::string &msg_body, int32_t msg_id, int32_t msg_type)
+{
+	uint32_t msg_start = frames.size();
+	frames.resize (msg_start + msg_body.size() + RCON_FRAME_OVERHEAD);
+	rconEncodeFrame ((uint8_t *)&frames[msg_start], msg_body.data(), msg_body.size(), msg_id, msg_type);
+}
+
+
+/**
+ * Sends messages built by appendFrame in one write, msg_body is only used to report errors
+ */
+int RCONSession::sendFrames (const std::string &frames, uint32_t frame_count, const std::string &msg_body)
+{
+	int return_value;
+	uint32_t msg_size = frames.size();
+	const uint8_t *msg = (const uint8_t *)frames.data();
+
+	// Spit out the message
+	logger->debug (DEBUG_DETAILED, ": Sending: ");
+	if (logger->getDebugLevel () >= DEBUG_DETAILED)
+	{
+		for (uint32_t t = 0; t < msg_size-1; t++)
+		{
+			logger->logx (msg[t], false);
+		}
+		logger->logx (msg[msg_size-1], true);
+	}
+
+	// Sends the message and makes sure it didn't fail
+	TRACE_BEGIN ("send");
+	return_value = write (sock, msg, msg_size);
+	TRACE_END ("send");
+	if (return_value < 0)
+	{
+		logger->logf (": Unable to send the following message to the RCON server: %s, reason: %s.\n", msg_body.c_str(), strerror(errno));
+		state = RCON_CLOSE;
+		return return_value;
+	}
+	else
+	{
+		metricAdd (METRIC_FRAMES_OUT, frame_count);
+		metricAdd (METRIC_BYTES_OUT, msg_size);
+
+		// TODO: Disable this debug message
+		logger->debugf (DEBUG_MINIMAL, ": Message sent successfully.\n");
+	}
+
+	return 0;
+}
+
+
+/**
+ * Sets the function every command reply is handed to
+ */
+void RCONSession::setReplyCallback (RCONReplyCallback callback, void *user_data)
+{
+	reply_callback = callback;
+	reply_user_data = user_data;
+}
+
+
+/**
+ * Sets the function called once the server accepts or rejects the password
+ */
+void RCONSession::setAuthCallback (RCONAuthCallback callback, void *user_data)
+{
+	auth_callback = callback;
+	auth_user_data = user_data;
+}
+
+
+/**
+ * Records how an auth attempt ended and tells the auth callback
+ */
+void RCONSession::finishAuth (int result)
+{
+	if (result <= 0)
+	{
+		metricAdd (METRIC_AUTH_FAILURES, 1);
+	}
+	auth_result = result;
+	if (auth_callback != NULL)
+	{
+		auth_callback (auth_user_data, result);
+	}
+}
+
+
+/**
+ * Sets the function called once each command has its whole reply
+ */
+void RCONSession::setCompleteCallback (RCONCompleteCallback callback, void *user_data)
+{
+	complete_callback = callback;
+	complete_user_data = user_data;
+}
+
+
+/**
+ * Returns the name of the dialect the session speaks
+ */
+template <class Dialect>
+const char *RCONSessionT<Dialect>::getDialect (void)
+{
+	return Dialect::name ();
+}
+
+
+/**
+ * Returns the command that lists the servers commands, or NULL if the dialect has none
+ */
+template <class Dialect>
+const char *RCONSessionT<Dialect>::getListCommand (void)
+{
+	return Dialect::list_command ();
+}
+
+
+/**
+ * Returns the command that reports the servers version, or NULL if the dialect has none
+ */
+template <class Dialect>
+const char *RCONSessionT<Dialect>::getVersionCommand (void)
+{
+	return Dialect::version_command ();
+}
+
+
+/**
+ * Returns the socket so the caller can wait on it in their own event loop
+ */
+int RCONSession::getSocket (void)
+{
+	return sock;
+}
+
+
+/**
+ * Returns the sessions current RCON task
+ */
+uint8_t RCONSession::getState (void)
+{
+	return state;
+}
+
+
+/**
+ * Returns the id of the last command sent
+ */
+int32_t RCONSession::getLastId (void)
+{
+	return last_id;
+}
+
+
+/**
+ * Reads from the socket and pulls the next complete message out of the buffer, returns the
+ * message size, 0 if no complete message has arrived yet or a negative value on error
+ */
+template <class Dialect>
+int RCONSessionT<Dialect>::readFrame (int32_t *msg_id, int32_t *msg_type, const char **body, uint32_t *body_length)
+{
+	int return_value;
+
+	// Only go to the socket if the buffer doesn't already hold a complete message, messages are read
+	// from buffer_start onwards so draining many small ones doesn't copy the rest of the buffer each time
+	struct RCONFrame frame;
+	int decode_value = rconDecodeFrame (&buffer[buffer_start], buffer_length - buffer_start, Dialect::max_frame, &frame);
+	if (decode_value == RCON_DECODE_INCOMPLETE)
+	{
+		// Move the partial message left over to the front of the buffer to make room for the rest
+		if (buffer_start > 0)
+		{
+			memmove (buffer, &buffer[buffer_start], buffer_length - buffer_start);
+			buffer_length -= buffer_start;
+			buffer_start = 0;
+		}
+
+		// Pull in as much as is waiting in one go, without blocking
+		TRACE_BEGIN ("recv");
+		return_value = recv (sock, &buffer[buffer_length], buffer_size - buffer_length, MSG_DONTWAIT);
+		TRACE_END ("recv");
+		if (return_value > 0)
+		{
+			buffer_length += return_value;
+			metricAdd (METRIC_BYTES_IN, return_value);
+		}
+		else if (return_value == 0)
+		{
+			// The server closed the connection
+			logger->log (": Error, the RCON server closed the connection.\n");
+			metricAdd (METRIC_SERVER_CLOSED, 1);
+			state = RCON_CLOSE;
+			return RCON_ERROR_CLOSED;
+		}
+		else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+		{
+			// Failed to read from the socket
+			logger->logf (": Error, failed to read from socket, closing socket: %s.\n", strerror(errno));
+			metricAdd (METRIC_RECV_FAILED, 1);
+			state = RCON_CLOSE;
+			return RCON_ERROR_RECV;
+		}
+
+		// Wait for the rest of the message
+		decode_value = rconDecodeFrame (buffer, buffer_length, Dialect::max_frame, &frame);
+		if (decode_value == RCON_DECODE_INCOMPLETE)
+		{
+			return 0;
+		}
+	}
+
+	// Make sure the message can fit in the buffer
+	logger->debugf (DEBUG_STANDARD, ": Size %d.\n", frame.data_size);
+	if (decode_value == RCON_DECODE_BAD_SIZE)
+	{
+		logger->logf (": Error on RCON socket, message size %d is invalid.\n", frame.data_size);
+		metricAdd (METRIC_BAD_SIZE, 1);
+		state = RCON_CLOSE;
+		return RCON_ERROR_SIZE;
+	}
+
+	// Consume the message from the buffer
+	int32_t data_size = frame.data_size;
+	uint8_t *rcon_size = &buffer[buffer_start];
+	char *rcon_recv = (char *)&buffer[buffer_start + 4];
+	buffer_start += data_size + 4;
+	metricAdd (METRIC_FRAMES_IN, 1);
+
+	logger->debug (DEBUG_STANDARD, ": Reading message.\n");
+	*msg_id = frame.msg_id;
+	*msg_type = frame.msg_type;
+	*body = frame.body;
+	*body_length = frame.body_length;
+
+	// Check message is correct
+	if (decode_value == RCON_DECODE_BAD_END)
+	{
+		logger->log (": Reply is missing ether the null terminator on the string, or the empty string at the end of the message.\n");
+		metricAdd (METRIC_BAD_END, 1);
+		return RCON_ERROR_END;
+	}
+	logger->debug (DEBUG_MINIMAL, ": Empty String OK.\n");
+
+	// Spit out the message
+	logger->debug (DEBUG_DETAILED, ": Received: ");
+	if (logger->getDebugLevel () >= DEBUG_DETAILED)
+	{
+		for (uint32_t t = 0; t < 4; t++)
+		{
+			logger->logx (rcon_size[t], false);
+		}
+		for (int32_t t = 0; t < data_size-1; t++)
+		{
+			logger->logx (rcon_recv[t], false);
+		}
+		logger->logx (rcon_recv[data_size-1], true);
+	}
+
+	return data_size;
+}
+
+
+// Build the session for each dialect
+template class RCONSessionT<SourceDialect>;
+template class RCONSessionT<MinecraftDialect>;
+template class RCONSessionT<FactorioDialect>;
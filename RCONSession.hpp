@@ -0,0 +1,140 @@
+#ifndef	_RCONSESSION_H
+#define _RCONSESSION_H
+
+#include <stdint.h>
+#include <string>
+
+#include "Logger.hpp"
+#include "RCONCodec.hpp"
+#include "RCONDialect.hpp"
+
+// Socket task defines
+#define RCON_CONNECT	0
+#define RCON_AUTH		1
+#define RCON_RUNNING	2
+#define RCON_CLOSE		3
+#define RCON_AUTH_WAIT	4
+
+// The id used for the auth message
+#define RCON_AUTH_ID	0x12131415
+
+// How many 100ms waits to allow for each auth reply
+#define RCON_AUTH_TIMEOUT	100
+
+// Errors from reading a message, each is counted in the metrics
+#define RCON_ERROR_RECV		-1
+#define RCON_ERROR_CLOSED	-2
+#define RCON_ERROR_SIZE		-3
+#define RCON_ERROR_ID		-4
+#define RCON_ERROR_TYPE		-5
+#define RCON_ERROR_END		-6
+
+// Set on the id of the message sent after each command to find the end of its reply
+#define RCON_TERMINATOR_FLAG	0x40000000
+
+// Called for every reply the server sends back to a command
+typedef void (*RCONReplyCallback) (void *user_data, int32_t msg_id, const char *body, uint32_t body_length);
+
+// Called once the server has sent the whole reply to a command
+typedef void (*RCONCompleteCallback) (void *user_data, int32_t msg_id);
+
+// Called once the server accepts or rejects the password, with the result authenticate would return
+typedef void (*RCONAuthCallback) (void *user_data, int result);
+
+// Define the RCONSession class
+class RCONSession;
+
+// Build the RCONSession class Template, the parts of a session every dialect shares
+class RCONSession
+{
+protected:
+	// Protected variables
+	Logger *logger;
+	int sock;
+	uint8_t state;
+	int32_t last_id;
+	bool has_connected;
+	RCONReplyCallback reply_callback;
+	void *reply_user_data;
+	RCONCompleteCallback complete_callback;
+	void *complete_user_data;
+	RCONAuthCallback auth_callback;
+	void *auth_user_data;
+	int auth_result;
+
+	// Used to buffer data received from the RCON server, sized by the dialect
+	uint8_t *buffer;
+	uint32_t buffer_size;
+	uint32_t buffer_length;
+	uint32_t buffer_start;
+
+	// Protected methods
+	void appendFrame (std::string &frames, const std::string &msg_body, int32_t msg_id, int32_t msg_type);
+	int sendFrames (const std::string &frames, uint32_t frame_count, const std::string &msg_body);
+	void finishAuth (int result);
+
+public:
+	// Constructors and destructor
+	RCONSession (Logger *session_logger);
+	virtual ~RCONSession ();
+	static RCONSession *create (Logger *session_logger, uint8_t dialect);
+
+	// Public methods
+	int connectServer (const char *address, int port);
+	virtual int authenticate (const char *password) = 0;
+	virtual int beginAuthenticate (const char *password) = 0;
+	virtual int32_t exec (const std::string &command) = 0;
+	virtual int poll (void) = 0;
+	virtual const char *getDialect (void) = 0;
+	virtual const char *getListCommand (void) = 0;
+	virtual const char *getVersionCommand (void) = 0;
+	void disconnect (void);
+	int sendMessage (const std::string &msg_body, int32_t msg_id, int32_t msg_type);
+	void setReplyCallback (RCONReplyCallback callback, void *user_data);
+	void setCompleteCallback (RCONCompleteCallback callback, void *user_data);
+	void setAuthCallback (RCONAuthCallback callback, void *user_data);
+	int getSocket (void);
+	uint8_t getState (void);
+	int32_t getLastId (void);
+};
+
+// Define the RCONSessionT class
+template <class Dialect> class RCONSessionT;
+
+// Build the RCONSessionT class Template, a session built for one dialect
+template <class Dialect>
+class RCONSessionT : public RCONSession
+{
+private:
+	// Private variables
+	int32_t completed_id;
+	int32_t auth_expected_type;
+	uint64_t auth_deadline;
+	int32_t fragment_id;
+	uint64_t fragment_deadline;
+
+	// Private methods
+	int readFrame (int32_t *msg_id, int32_t *msg_type, const char **body, uint32_t *body_length);
+	void checkAuthFrame (int32_t msg_id, int32_t msg_type);
+	void completeReply (int32_t msg_id);
+
+public:
+	// Constructors and destructor
+	RCONSessionT (Logger *session_logger);
+
+	// Public methods
+	int authenticate (const char *password);
+	int beginAuthenticate (const char *password);
+	int32_t exec (const std::string &command);
+	int poll (void);
+	const char *getDialect (void);
+	const char *getListCommand (void);
+	const char *getVersionCommand (void);
+};
+
+// The sessions for each dialect, built in RCONSession.cpp
+typedef RCONSessionT<SourceDialect> SourceRCONSession;
+typedef RCONSessionT<MinecraftDialect> MinecraftRCONSession;
+typedef RCONSessionT<FactorioDialect> FactorioRCONSession;
+
+#endif
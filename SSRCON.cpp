@@ -11,23 +11,43 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include <deque>
 #include <iostream>
+#include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "SSRCON.hpp"
 #include "Logger.hpp"
+#include "RCONSession.hpp"
+#include "History.hpp"
+#include "Trace.hpp"
+#include "Metrics.hpp"
+#include "LoadTest.hpp"
+#include "Completion.hpp"
+#include "Watch.hpp"
 
 #define VERSION "1.00"
 
 // Local function prototypes
-int sendRCONMessage (std::string msg_body, int32_t msg_id, int32_t msg_type);
-int readRCONMessage (int32_t expected_id, int32_t expected_type);
+void queueReply (void *, int32_t msg_id, const char *body, uint32_t body_length);
+void replyComplete (void *, int32_t msg_id);
+void queueOutput (int32_t msg_id, std::string &msg_body, const char *direction, uint8_t kind);
+void filterReply (struct ReplyFilter &filter, const char *body, uint32_t body_length, std::string &matched);
+void flushFilter (int32_t msg_id);
+void archiveReply (void);
+void openCompletionCache (void);
+void showCompletions (const std::string &prefix);
+void showWatchChanges (int32_t msg_id);
+time_t parseTime (const char *text);
+uint64_t monotonicMicros (void);
 void *consoleThread (void *);
+void *outputThread (void *);
 void signalHandler (int signum);
 
 // Thread handling
@@ -36,20 +56,88 @@ pthread_mutex_t console_mutex;
 std::string new_command;
 bool console_running = true;
 
+// Responses are handed to the output thread so logging never holds up the socket
+pthread_t output_thread;
+pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t output_cond = PTHREAD_COND_INITIALIZER;
+struct OutputMessage
+{
+	int32_t msg_id;
+	const char *direction;
+	uint8_t kind;
+	std::string body;
+};
+std::deque<OutputMessage> output_queue;
+bool output_running = true;
+
 // Global Varible
 uint8_t debug_level = DEBUG_NONE;
 Logger *logger;
 volatile sig_atomic_t closing_process = 0;
 volatile sig_atomic_t close_reason = 0;
+volatile sig_atomic_t trace_requested = 0;
+std::string trace_file;
 
 // Used for RCON connection
-uint8_t rcon_task = 0;
-int rcon_return;
-int rcon_sock = -1;
+RCONSession *session;
 int rcon_port = DEFAULT_RCON_PORT;
-struct sockaddr_in rcon_serv_addr;
-hostent *rcon_server;
-int32_t rcon_id = 0;
+uint8_t rcon_dialect = RCON_DIALECT_SOURCE;
+
+// Used to only show the reply lines that contain the filter text, each command keeps its own filter
+// by id, along with the unfinished line held back from the last part of its reply
+struct ReplyFilter
+{
+	std::string text;
+	std::string partial;
+};
+std::string user_filter;
+std::map<int32_t, struct ReplyFilter> reply_filters;
+
+// Used to archive each command with its replies
+History *history = NULL;
+std::string server_name;
+std::string last_command;
+int32_t last_command_id = 0;
+bool awaiting_reply = false;
+uint64_t last_command_time = 0;
+std::string history_reply;
+bool history_pending = false;
+
+// Used to complete command names, from a list the server is asked for once authorised
+CompletionIndex *completions = NULL;
+CompletionIndex *completion_fetch = NULL;
+std::string completion_file;
+int32_t completion_id = -1;
+std::string completion_version;
+int32_t completion_version_id = -1;
+
+// Used to re-run a command and only show the lines of its reply that changed
+WatchDiff *watch = NULL;
+std::string watch_command;
+double watch_interval = 0;
+int32_t watch_id = -1;
+bool watch_pending = false;
+uint64_t watch_next = 0;
+uint64_t watch_started = 0;
+std::string watch_response;
+std::set<int32_t> watch_abandoned;
+
+// Used to serve the metrics
+std::string metrics_socket;
+
+// Used to search the archive instead of connecting
+bool history_query = false;
+time_t query_from = 0;
+time_t query_to = 0;
+std::string query_command;
+
+// Used to run a load test instead of the console
+bool load_test = false;
+uint32_t load_sessions = 0;
+double load_rate = 0;
+uint32_t load_duration = 0;
+uint32_t load_ramp = 0;
+std::string load_mix;
 
 // Used to hold server, port and password data
 std::string user_address;
@@ -58,8 +146,16 @@ std::string user_password;
 
 int main(int argc, char **argv)
 {
-	// Setup the logger and log the start of the process
-	logger = new Logger ("SSRCON.log");
+	// Setup the logger and log the start of the process, the log format is picked first so every line uses it
+	logger = new Logger ();
+	for (int arg_count = 1; arg_count < argc; arg_count++)
+	{
+		if (strcmp(argv[arg_count], "-j") == 0)
+		{
+			logger->setLogFormat (LOG_FORMAT_JSON);
+		}
+	}
+	logger->setLogFileLocation ("SSRCON.log");
 	logger->setLinePrefix ("SSRCON");
 	logger->log (": Started version " VERSION " compiled on " __DATE__ ", " __TIME__ ".\n");
 
@@ -73,6 +169,8 @@ int main(int argc, char **argv)
 	signal (SIGBUS, &signalHandler);
 	// All SIGCHLD signals are ignored, otherwise the child process becomes a zombie when closed
 	signal (SIGCHLD, SIG_IGN);
+	// SIGUSR1 writes out the trace so far
+	signal (SIGUSR1, &signalHandler);
 	// ALL SIGPIPE signals are ignored, otherwise the program exits if it tries to write after the connection has dropped
 	signal (SIGPIPE, SIG_IGN);
 
@@ -149,16 +247,229 @@ int main(int argc, char **argv)
 				logger->log (": Why did you set the user password flag without the user password value?.\n");
 			}
 		}
+		// Process log rotation argument
+		if (strcmp(argv[arg_count], "-r") == 0)
+		{
+			// Check to make a log size was set
+			if (argc - 1 >= arg_count + 1)
+			{
+				uint64_t max_log_size = strtoull (argv[arg_count+1], NULL, 10);
+				logger->setRotation (max_log_size * 1024 * 1024, 0, LOG_ROTATE_FILES, true);
+				logger->logf (": Rotating the log file every %llu MB.\n", (unsigned long long)max_log_size);
+				arg_count++;
+			}
+			else
+			{
+				logger->log (": Why did you set the log rotation flag without the log size value?.\n");
+			}
+		}
+		// Process JSON log argument
+		if (strcmp(argv[arg_count], "-j") == 0)
+		{
+			logger->log (": Writing the log file as JSON lines.\n");
+		}
+		// Process filter argument
+		if (strcmp(argv[arg_count], "-f") == 0)
+		{
+			// Check to make a filter was set
+			if (argc - 1 >= arg_count + 1)
+			{
+				user_filter = argv[arg_count+1];
+				logger->logf (": Only showing reply lines containing: %s.\n", user_filter.c_str());
+				arg_count++;
+			}
+			else
+			{
+				logger->log (": Why did you set the filter flag without the filter value?.\n");
+			}
+		}
+		// Process trace argument
+		if (strcmp(argv[arg_count], "-t") == 0)
+		{
+			// Check to make a trace file was set
+			if (argc - 1 >= arg_count + 1)
+			{
+				trace_file = argv[arg_count+1];
+				traceEnable ();
+				traceThreadName ("network");
+				logger->logf (": Tracing to %s, send SIGUSR1 to write it out early.\n", trace_file.c_str());
+				arg_count++;
+			}
+			else
+			{
+				logger->log (": Why did you set the trace flag without the trace file value?.\n");
+			}
+		}
+		// Process metrics argument
+		if (strcmp(argv[arg_count], "-m") == 0)
+		{
+			// Check to make a socket path was set
+			if (argc - 1 >= arg_count + 1)
+			{
+				metrics_socket = argv[arg_count+1];
+				if (metricsServe (metrics_socket.c_str()) == 1)
+				{
+					logger->logf (": Serving metrics on %s.\n", metrics_socket.c_str());
+				}
+				else
+				{
+					logger->logf (": Unable to serve metrics on %s: %s.\n", metrics_socket.c_str(), strerror(errno));
+					metrics_socket.clear ();
+				}
+				arg_count++;
+			}
+			else
+			{
+				logger->log (": Why did you set the metrics flag without the socket path value?.\n");
+			}
+		}
+		// Process archive argument
+		if (strcmp(argv[arg_count], "-a") == 0)
+		{
+			if (history == NULL)
+			{
+				history = new History (HISTORY_FILE);
+			}
+			logger->log (": Archiving commands and replies to " HISTORY_FILE ".\n");
+		}
+		// Process history query argument
+		if (strcmp(argv[arg_count], "-q") == 0)
+		{
+			// Check to make the times and command were set
+			if (argc - 1 >= arg_count + 3)
+			{
+				history_query = true;
+				query_from = parseTime (argv[arg_count+1]);
+				query_to = parseTime (argv[arg_count+2]);
+				query_command = argv[arg_count+3];
+				arg_count += 3;
+			}
+			else
+			{
+				logger->log (": Why did you set the history query flag without the from, to and command values?.\n");
+			}
+		}
+		// Process load test argument
+		if (strcmp(argv[arg_count], "-L") == 0)
+		{
+			// Check to make the sessions, rate, duration, ramp and command mix were set
+			if (argc - 1 >= arg_count + 5)
+			{
+				load_test = true;
+				load_sessions = strtoul (argv[arg_count+1], NULL, 10);
+				load_rate = strtod (argv[arg_count+2], NULL);
+				load_duration = strtoul (argv[arg_count+3], NULL, 10);
+				load_ramp = strtoul (argv[arg_count+4], NULL, 10);
+				load_mix = argv[arg_count+5];
+				arg_count += 5;
+			}
+			else
+			{
+				logger->log (": Why did you set the load test flag without the sessions, rate, duration, ramp and command mix values?.\n");
+			}
+		}
+		// Process watch argument
+		if (strcmp(argv[arg_count], "-w") == 0)
+		{
+			// Check to make the interval and command were set
+			if (argc - 1 >= arg_count + 2)
+			{
+				watch_interval = strtod (argv[arg_count+1], NULL);
+				watch_command = argv[arg_count+2];
+				if (watch == NULL)
+				{
+					watch = new WatchDiff ();
+				}
+				logger->logf (": Watching %s every %g seconds.\n", watch_command.c_str(), watch_interval);
+				arg_count += 2;
+			}
+			else
+			{
+				logger->log (": Why did you set the watch flag without the interval and command values?.\n");
+			}
+		}
+		// Process game dialect argument
+		if (strcmp(argv[arg_count], "-g") == 0)
+		{
+			// Check to make a dialect was set
+			if (argc - 1 >= arg_count + 1)
+			{
+				if (strcmp(argv[arg_count+1], "source") == 0)
+				{
+					rcon_dialect = RCON_DIALECT_SOURCE;
+				}
+				else if (strcmp(argv[arg_count+1], "minecraft") == 0)
+				{
+					rcon_dialect = RCON_DIALECT_MINECRAFT;
+				}
+				else if (strcmp(argv[arg_count+1], "factorio") == 0)
+				{
+					rcon_dialect = RCON_DIALECT_FACTORIO;
+				}
+				else
+				{
+					logger->logf (": Unknown game dialect %s, using source.\n", argv[arg_count+1]);
+				}
+				arg_count++;
+			}
+			else
+			{
+				logger->log (": Why did you set the game dialect flag without the dialect value?.\n");
+			}
+		}
+	}
+
+	// Search the archive and exit rather than connecting
+	if (history_query)
+	{
+		// Records are kept under the server and port as they were given, without -p the default port is assumed
+		std::string query_server;
+		if (user_address.length() > 0)
+		{
+			query_server = user_address + ":" + ((user_port.length() > 0) ? user_port : std::to_string (DEFAULT_RCON_PORT));
+		}
+		int found = History::query (HISTORY_FILE, query_from, query_to,
+			(query_server.length() > 0) ? query_server.c_str() : NULL,
+			(query_command != "*") ? query_command.c_str() : NULL);
+		logger->logf (": Found %d archived replies.\n", (found > 0) ? found : 0);
+		delete history;
+		delete logger;
+		return (found >= 0) ? 0 : 1;
 	}
 	
-	// Start the console thread
+	// Run the load test and exit rather than starting the console
+	if (load_test)
+	{
+		if ((user_address.length() == 0) || (user_port.length() == 0) || (user_password.length() == 0))
+		{
+			logger->log (": The load test needs the server, port and password set with -s, -p and -u.\n");
+			delete logger;
+			return 1;
+		}
+
+		logger->logf (": Load testing %s:%s with %u sessions at %.1f commands a second for %u seconds.\n",
+			user_address.c_str(), user_port.c_str(), load_sessions, load_rate, load_duration);
+		int return_value = runLoadTest (logger, user_address.c_str(), strtol (user_port.c_str(), NULL, 10), user_password.c_str(), rcon_dialect,
+			load_sessions, load_rate, load_duration, load_ramp, load_mix.c_str());
+		delete logger;
+		return return_value;
+	}
+
+	// Start the console and output threads
 	pthread_create(&console_thread, NULL, consoleThread, NULL);
+	pthread_create(&output_thread, NULL, outputThread, NULL);
+
+	// Replies from the session are handed to the output thread
+	session = RCONSession::create (logger, rcon_dialect);
+	session->setReplyCallback (&queueReply, NULL);
+	session->setCompleteCallback (&replyComplete, NULL);
+	logger->logf (": Speaking the %s RCON dialect.\n", session->getDialect ());
 
 	// Loop until the process is closed
 	while (closing_process != 1)
 	{
 		// Handle RCON connection
-		switch (rcon_task)
+		switch (session->getState ())
 		{
 			// Connect to the given server and port
 			case (RCON_CONNECT):
@@ -204,38 +515,18 @@ int main(int argc, char **argv)
 					rcon_port = DEFAULT_RCON_PORT;
 				}
 
-				// Create socket
-				rcon_sock = socket(AF_INET, SOCK_STREAM, 0);
-				rcon_server = gethostbyname(user_address.c_str());
-				if ((rcon_sock >= 0) && (rcon_server != NULL))
-				{
-					// Sets up the server address
-					bzero((char *) &rcon_serv_addr, sizeof(rcon_serv_addr));
-					rcon_serv_addr.sin_family = AF_INET;
-					bcopy((char *)rcon_server->h_addr, (char *)&rcon_serv_addr.sin_addr.s_addr, rcon_server->h_length);
-					rcon_serv_addr.sin_port = htons(rcon_port);
-
-					// Connect
-					rcon_return = connect (rcon_sock, (struct sockaddr *) &rcon_serv_addr, sizeof (rcon_serv_addr));
-					if (rcon_return >= 0)
-					{
-						rcon_task = RCON_AUTH;
-						logger->log (": Connected to the RCON server.\n");
-						break;
-					}
-					else
-					{
-						logger->logf (": Unable to get the server host: %s.\n", strerror(errno));
-					}
-				}
-				else
+				TRACE_BEGIN ("connect server");
+				int return_value = session->connectServer (user_address.c_str(), rcon_port);
+				TRACE_END ("connect server");
+				if (return_value == 1)
 				{
-					logger->logf (": Unable to open a socket, or find the server: %s.\n", strerror(errno));
+					server_name = user_address + ":" + user_port;
+					logger->setServerName (server_name.c_str());
 				}
 			}
 			break;
 
-			// Authorise with the server (temporally fudged)
+			// Authorise with the server
 			case (RCON_AUTH):
 			{
 				// Get the server password from the user if it's blank
@@ -256,72 +547,55 @@ int main(int argc, char **argv)
 				}
 				
 				// Send password to the server and wait for response and auth messages
-				if (sendRCONMessage (user_password.c_str(), 0x12131415, SERVERDATA_AUTH) == 0)
+				TRACE_BEGIN ("authenticate");
+				int return_value = session->authenticate (user_password.c_str());
+				TRACE_END ("authenticate");
+				if (return_value == 1)
 				{
-					// Wait for response value
-					uint32_t rcon_timeout = 0;
-					int return_value = readRCONMessage (0x12131415, SERVERDATA_RESPONSE_VALUE);
-					while ((return_value == 0) && (rcon_timeout < 100))
+					// Start from the cached names, and ask the server for a fresh list in the background
+					// The fresh list goes in its own index so names the server dropped don't linger, servers
+					// without a command that lists them have nothing to complete
+					// The cache is named after the servers version, so it's only read once that has arrived
+					delete completions;
+					completions = NULL;
+					delete completion_fetch;
+					completion_fetch = NULL;
+					completion_version_id = -1;
+					if (session->getListCommand () != NULL)
 					{
-						rcon_timeout++;
-						return_value = readRCONMessage (0x12131415, SERVERDATA_RESPONSE_VALUE);
-						usleep (100000);
-					}
-
-					// Check if we timed out
-					if (rcon_timeout >= 100)
-					{
-						logger->logf (": Warning, timed out while waiting for SERVERDATA_RESPONSE_VALUE.\n");
-						user_password.clear ();
-					}
-					// Check the reply was deamed valid
-					else if (return_value > 0)
-					{
-						// Wait for auth response
-						rcon_timeout = 0;
-						return_value = readRCONMessage (0x12131415, SERVERDATA_AUTH_RESPONSE);
-						while ((return_value == 0) && (rcon_timeout < 100))
-						{
-							rcon_timeout++;
-							return_value = readRCONMessage (0x12131415, SERVERDATA_AUTH_RESPONSE);
-							usleep (100000);
-						}
-
-						// Check if we timed out
-						if (rcon_timeout >= 100)
-						{
-							logger->logf (": Warning, timed out while waiting for SERVERDATA_AUTH_RESPONSE.\n");
-							user_password.clear ();
-						}
-						// Check the reply was deamed valid
-						else if (return_value > 0)
-						{
-							rcon_task = RCON_RUNNING;
-						}
-						else if (return_value == -3)
+						completions = new CompletionIndex ();
+						completion_fetch = new CompletionIndex ();
+						completion_file.clear ();
+						completion_version.clear ();
+						if (session->getVersionCommand () != NULL)
 						{
-							// This should trigger if the password was wrong
-							logger->logf (": Error, server reponded with a different ID, your password may be wrong.\n");
-							user_password.clear ();
+							completion_version_id = session->exec (session->getVersionCommand ());
 						}
-						else
+						if (completion_version_id < 0)
 						{
-							logger->logf (": Error, server did not respond with a valid SERVERDATA_AUTH_RESPONSE, disconnecting.\n");
-							user_address.clear ();
-							user_port.clear ();
-							user_password.clear ();
-							rcon_task = RCON_CLOSE;
+							openCompletionCache ();
 						}
+						completion_id = session->exec (session->getListCommand ());
 					}
-					else
+
+					// Commands that were running when the connection dropped will never finish
+					watch_pending = false;
+					watch_abandoned.clear ();
+					while (!reply_filters.empty ())
 					{
-						logger->logf (": Error, server did not respond to SERVERDATA_AUTH command with a valid SERVERDATA_RESPONSE_VALUE first, disconnecting.\n");
-						user_address.clear ();
-						user_port.clear ();
-						user_password.clear ();
-						rcon_task = RCON_CLOSE;
+						flushFilter (reply_filters.begin ()->first);
 					}
 				}
+				else if (return_value == 0)
+				{
+					user_password.clear ();
+				}
+				else if ((return_value < 0) && (session->getState () == RCON_CLOSE))
+				{
+					user_address.clear ();
+					user_port.clear ();
+					user_password.clear ();
+				}
 			}
 			break;
 
@@ -329,33 +603,97 @@ int main(int argc, char **argv)
 			case (RCON_RUNNING):
 			{
 				// Send command to RCON
+				TRACE_BEGIN ("console_mutex");
 				pthread_mutex_lock (&console_mutex);
-				if (new_command.length() > 0)
+				TRACE_END ("console_mutex");
+				if ((new_command.length() > 0) && (new_command[new_command.length() - 1] == '\t'))
+				{
+					// A line ending in a tab asks for the commands it could be
+					new_command.erase (new_command.length() - 1);
+					showCompletions (new_command);
+					new_command.clear ();
+				}
+				else if (new_command.length() > 0)
 				{
-					rcon_id++;
-					logger->logf (": Sending: %s\n", new_command.c_str());
-					sendRCONMessage (new_command, rcon_id, SERVERDATA_EXECCOMMAND);
+					// Finish off the last commands archive, then pull a filter off the end of this one
+					archiveReply ();
+					std::string command_filter = user_filter;
+					size_t match_start = new_command.rfind (" | match ");
+					if (match_start != std::string::npos)
+					{
+						command_filter = new_command.substr (match_start + 9);
+						new_command.erase (match_start);
+					}
+
+					int32_t msg_id = session->exec (new_command);
+					if ((msg_id >= 0) && (!command_filter.empty ()))
+					{
+						reply_filters[msg_id].text = command_filter;
+					}
+					last_command = new_command;
+					last_command_id = msg_id;
+					history_pending = (history != NULL);
+					awaiting_reply = true;
+					last_command_time = monotonicMicros ();
+					metricSetGauge (METRIC_IN_FLIGHT, 1);
+					TRACE_ASYNC_BEGIN ("request", msg_id);
+					logger->logMessage ("Sending", msg_id, new_command.c_str(), new_command.size());
 					new_command.clear ();
 				}
 				pthread_mutex_unlock (&console_mutex);
 
-				// Get responce
-				readRCONMessage (rcon_id, SERVERDATA_RESPONSE_VALUE);
+				// Give up on a run that never completed, or the watch would stop for good
+				uint64_t watch_timeout = (uint64_t)(watch_interval * 1000000.0 * WATCH_TIMEOUT_INTERVALS);
+				if (watch_timeout < WATCH_MIN_TIMEOUT)
+				{
+					watch_timeout = WATCH_MIN_TIMEOUT;
+				}
+				if ((watch != NULL) && (watch_pending) && (monotonicMicros () >= watch_started + watch_timeout))
+				{
+					logger->logf (": Warning, the watched command %s didn't finish within %.1f seconds, running it again.\n",
+						watch_command.c_str(), watch_timeout / 1000000.0);
+					watch_abandoned.insert (watch_id);
+					watch_pending = false;
+				}
+
+				// Run the watched command again once the last run has its whole reply and the interval is up
+				if ((watch != NULL) && (!watch_pending) && (monotonicMicros () >= watch_next))
+				{
+					watch_started = monotonicMicros ();
+					watch_next = watch_started + (uint64_t)(watch_interval * 1000000.0);
+					watch_response.clear ();
+					watch_id = session->exec (watch_command);
+					watch_pending = (watch_id >= 0);
+				}
+
+				// Get responce, handling every message that has already arrived
+				session->poll ();
 			}
 			break;
 
 			// Close the server
 			case (RCON_CLOSE):
 			{
-				close (rcon_sock);
-				rcon_sock = -1;
-
-				rcon_task = RCON_CONNECT;
+				session->disconnect ();
 				sleep (2);
 			}
 			break;
 		}
 
+		// Write out the trace if it was asked for, SIGUSR1 is still caught without -t so it can't close the process
+		if (trace_requested)
+		{
+			trace_requested = 0;
+			if (trace_file.length() > 0)
+			{
+				logger->logf (": Wrote %d trace events to %s.\n", traceWrite (trace_file.c_str()), trace_file.c_str());
+			}
+			else
+			{
+				logger->log (": Ignoring SIGUSR1, tracing wasn't turned on with -t.\n");
+			}
+		}
+
 		usleep (100000);
 	}
 
@@ -386,198 +724,352 @@ int main(int argc, char **argv)
 		break;
 	}
 
-	// Close the socket
-	if (rcon_sock != -1)
+	// Let out filtered lines still held back, and archive the reply, from commands that never completed
+	while (!reply_filters.empty ())
 	{
-		close (rcon_sock);
-		rcon_sock = -1;
+		flushFilter (reply_filters.begin ()->first);
 	}
+	archiveReply ();
+
+	// Close the socket
+	delete session;
+	session = NULL;
+	delete history;
+	history = NULL;
+	delete completions;
+	completions = NULL;
+	delete completion_fetch;
+	completion_fetch = NULL;
+	delete watch;
+	watch = NULL;
 	
 	pthread_mutex_lock (&console_mutex);
 	console_running = false;
 	pthread_mutex_unlock (&console_mutex);
 
+	// Let the output thread finish writing any queued responses
+	pthread_mutex_lock (&output_mutex);
+	output_running = false;
+	pthread_cond_signal (&output_cond);
+	pthread_mutex_unlock (&output_mutex);
+	pthread_join (output_thread, NULL);
+
+	if (metrics_socket.length() > 0)
+	{
+		unlink (metrics_socket.c_str());
+	}
+	if (trace_file.length() > 0)
+	{
+		logger->logf (": Wrote %d trace events to %s.\n", traceWrite (trace_file.c_str()), trace_file.c_str());
+	}
+
 	logger->log (": Exited.\n");
 	delete logger;
 
 	return 0;
 }
 
-// Send an RCON Message
-int sendRCONMessage (std::string msg_body, int32_t msg_id, int32_t msg_type)
+// Called by the session for each reply, queues it for the output thread
+void queueReply (void *, int32_t msg_id, const char *body, uint32_t body_length)
 {
-	int return_value;
+	// The version and command list are for completion, not for the user
+	if ((completion_version_id >= 0) && (msg_id == completion_version_id))
+	{
+		completion_version.append (body, body_length);
+		return;
+	}
+	if ((completion_fetch != NULL) && (msg_id == completion_id))
+	{
+		completion_fetch->addListing (body, body_length);
+		return;
+	}
 
-	// Prepares the message
-	uint8_t *msg;
-	uint32_t msg_size = msg_body.size() + 14;
-	int32_t msg_body_size = msg_size - 4;
-	msg = (uint8_t*) malloc (msg_size * sizeof (uint8_t));
-	memset (msg, 0, msg_size * sizeof (uint8_t));
+	// The watched command is only shown once its whole reply can be compared with the last one
+	if ((watch != NULL) && (msg_id == watch_id))
+	{
+		watch_response.append (body, body_length);
+		return;
+	}
 
-	// Adds the message size
-	memcpy (&msg[0], &msg_body_size, sizeof (int32_t));
+	// Runs of the watched command that were given up on are dropped if they turn up late
+	if ((watch != NULL) && (watch_abandoned.count (msg_id) > 0))
+	{
+		return;
+	}
 
-	// Adds the message id
-	memcpy (&msg[4], &msg_id, sizeof (int32_t));
+	// The first reply ends the request, the server has finished thinking
+	if ((awaiting_reply) && (msg_id == last_command_id))
+	{
+		TRACE_ASYNC_END ("request", msg_id);
+		awaiting_reply = false;
+		metricObserveLatency (monotonicMicros () - last_command_time);
+		metricSetGauge (METRIC_IN_FLIGHT, 0);
+	}
 
-	// Adds the message type
-	memcpy (&msg[8], &msg_type, sizeof (int32_t));
+	// Gather the whole reply to archive, before any filtering
+	if ((history_pending) && (msg_id == last_command_id))
+	{
+		history_reply.append (body, body_length);
+	}
 
-	// Adds the message body
-	memcpy (&msg[12], msg_body.c_str(), msg_body.size() * sizeof (uint8_t));
-	
-	// Null terminate the body (byte should already be null but sanity)
-	msg[msg_size-2] = 0x00;
+	std::string msg_body;
+	std::map<int32_t, struct ReplyFilter>::iterator filter = reply_filters.find (msg_id);
+	if (filter == reply_filters.end ())
+	{
+		msg_body.assign (body, body_length);
+	}
+	else
+	{
+		filterReply (filter->second, body, body_length, msg_body);
+	}
+
+	if (!msg_body.empty ())
+	{
+		queueOutput (msg_id, msg_body, "Received", OUTPUT_REPLY);
+	}
+}
+
+// Hands a reply to the output thread
+void queueOutput (int32_t msg_id, std::string &msg_body, const char *direction, uint8_t kind)
+{
+	pthread_mutex_lock (&output_mutex);
+	output_queue.push_back (OutputMessage ());
+	output_queue.back ().msg_id = msg_id;
+	output_queue.back ().direction = direction;
+	output_queue.back ().kind = kind;
+	output_queue.back ().body.swap (msg_body);
+	metricSetGauge (METRIC_QUEUE_DEPTH, output_queue.size ());
+	pthread_cond_signal (&output_cond);
+	pthread_mutex_unlock (&output_mutex);
+}
 
-	// Adds the message body (byte should already be null but sanity)
-	msg[msg_size-1] = 0x00;
+// Copies out only the lines containing the filter, jumping between matches rather than
+// looking at every line, a line split across two replies is held until it is complete
+void filterReply (struct ReplyFilter &filter, const char *body, uint32_t body_length, std::string &matched)
+{
+	const char *start = body;
+	const char *end = body + body_length;
 
-	// Spit out the message
-	logger->debug (DEBUG_DETAILED, ": Sending: ");
-	if (debug_level >= DEBUG_DETAILED)
+	// Finish the line left over from the last reply
+	if (!filter.partial.empty ())
 	{
-		for (uint32_t t = 0; t < msg_size-1; t++)
+		const char *line_end = (const char *)memchr (start, '\n', end - start);
+		if (line_end == NULL)
 		{
-			logger->logx (msg[t], false);
+			filter.partial.append (start, end - start);
+			return;
 		}
-		logger->logx (msg[msg_size-1], true);
+		filter.partial.append (start, line_end - start + 1);
+		if (memmem (filter.partial.data (), filter.partial.size (), filter.text.data (), filter.text.size ()) != NULL)
+		{
+			matched.append (filter.partial);
+		}
+		filter.partial.clear ();
+		start = line_end + 1;
 	}
 
-	// Sends the message and makes sure it didn't fail
-	return_value = write (rcon_sock, msg, msg_size);
-	if (return_value < 0)
+	// Hold back the unfinished line at the end of the reply
+	const char *last_line = (const char *)memrchr (start, '\n', end - start);
+	last_line = (last_line == NULL) ? start : last_line + 1;
+	filter.partial.assign (last_line, end - last_line);
+
+	// Jump from match to match, copying out the whole line around each one
+	while (start < last_line)
 	{
-		logger->logf (": Unable to send the following message to the RCON server: %s, reason: %s.\n", msg_body.c_str(), strerror(errno));
-		rcon_task = RCON_CLOSE;
-		return return_value;
+		const char *hit = (const char *)memmem (start, last_line - start, filter.text.data (), filter.text.size ());
+		if (hit == NULL)
+		{
+			break;
+		}
+		const char *line_start = (const char *)memrchr (start, '\n', hit - start);
+		line_start = (line_start == NULL) ? start : line_start + 1;
+		const char *line_end = (const char *)memchr (hit, '\n', last_line - hit);
+		matched.append (line_start, line_end - line_start + 1);
+		start = line_end + 1;
 	}
-	else
+}
+
+// Checks the last unfinished line of a commands reply once no more of it is coming, and drops its filter
+void flushFilter (int32_t msg_id)
+{
+	std::map<int32_t, struct ReplyFilter>::iterator filter = reply_filters.find (msg_id);
+	if (filter == reply_filters.end ())
+	{
+		return;
+	}
+	if ((!filter->second.partial.empty ()) &&
+		(memmem (filter->second.partial.data (), filter->second.partial.size (), filter->second.text.data (), filter->second.text.size ()) != NULL))
 	{
-		// TODO: Disable this debug message
-		logger->debugf (DEBUG_MINIMAL, ": Message sent successfully.\n");
+		queueOutput (msg_id, filter->second.partial, "Received", OUTPUT_REPLY);
 	}
+	reply_filters.erase (filter);
+}
 
-	free (msg);
-	msg = NULL;
-	return 0;
+// Reads a time given as "YYYY/MM/DD HH:MM:SS" in UTC, the same as the log, or as seconds since 1970
+time_t parseTime (const char *text)
+{
+	struct tm text_tm;
+	memset (&text_tm, 0, sizeof (text_tm));
+	const char *end = strptime (text, "%Y/%m/%d %H:%M:%S", &text_tm);
+	if ((end != NULL) && (*end == 0))
+	{
+		return timegm (&text_tm);
+	}
+	return strtoll (text, NULL, 10);
 }
 
-// Reads from the socket and checks the returned values
-int readRCONMessage (int32_t expected_id, int32_t expected_type)
+// Called by the session once a command has its whole reply
+void replyComplete (void *, int32_t msg_id)
 {
-	int return_value;
-	uint32_t available;
-	
-	// Check if there is a message waiting
-	return_value = ioctl (rcon_sock, FIONREAD, &available);
-	if (available >= 4)
+	// Archive the command with its whole reply
+	if (msg_id == last_command_id)
 	{
-		// Creating receive buffers
-		char rcon_size[4];
-		memset (rcon_size, 0, 4);
-		char rcon_recv[MAXDATAREAD];
-		memset (rcon_recv, 0, MAXDATAREAD);
+		archiveReply ();
+	}
 
-		// Read the message size
-		logger->debug (DEBUG_STANDARD, ": About to read size.\n");
-		// TODO: make this code none blocking, with a max wait time of 10 seconds
-		rcon_return = read(rcon_sock, rcon_size, 4);
-		if (rcon_return > 0)
-		{
-			int32_t data_size = 0;
-			memcpy (&data_size, rcon_size, sizeof (int32_t));
+	// Filtering holds back the last line of each part of the reply, so let it out now the reply is over
+	flushFilter (msg_id);
 
-			// Read the rest of the message
-			logger->debugf (DEBUG_STANDARD, ": Size %d.\n", data_size);
-			rcon_return = read(rcon_sock, rcon_recv, data_size);
-			if (rcon_return > 0)
-			{
-				logger->debug (DEBUG_STANDARD, ": Reading message.\n");
+	// The version names the cache, so it can be opened now
+	if ((completion_version_id >= 0) && (msg_id == completion_version_id))
+	{
+		completion_version_id = -1;
+		openCompletionCache ();
+	}
 
-				// Pull the message id
-				int32_t msg_id = 0;
-				memcpy (&msg_id, rcon_recv, sizeof (int32_t));
+	// Swap in the fresh command list and cache it for the next run, once the cache has a name
+	if ((completion_fetch != NULL) && (msg_id == completion_id))
+	{
+		completion_fetch->build ();
+		delete completions;
+		completions = completion_fetch;
+		completion_fetch = NULL;
+		if (!completion_file.empty ())
+		{
+			logger->debugf (DEBUG_MINIMAL, ": Cached %d command names.\n", completions->save (completion_file.c_str()));
+		}
+	}
 
-				// Read the message type
-				int32_t msg_type = 0;
-				memcpy (&msg_type, &rcon_recv[4], sizeof (int32_t));
+	if ((watch != NULL) && (msg_id == watch_id) && (watch_pending))
+	{
+		watch_pending = false;
+		showWatchChanges (msg_id);
+	}
 
-				// Read the message body
-				std::string msg_body (&rcon_recv[8], data_size - 9);
+	// An abandoned run printed nothing, so there's no line to finish
+	if (watch_abandoned.erase (msg_id) > 0)
+	{
+		return;
+	}
 
-				// Check message is correct
-				if (expected_id == msg_id)
-				{
-					logger->debug (DEBUG_MINIMAL, ": ID OK.\n");
-				}
-				else
-				{
-					logger->log (": Reply ID did not match original message.\n");
-					return -4;
-				}
-				if (expected_type == msg_type)
-				{
-					logger->debug (DEBUG_MINIMAL, ": Type OK.\n");
-				}
-				else
-				{
-					logger->log (": Reply message type did not match expected type.\n");
-					return -5;
-				}
-				if ((rcon_recv[data_size-2] == 0x00) && (rcon_recv[data_size-1] == 0x00))
-				{
-					logger->debug (DEBUG_MINIMAL, ": Empty String OK.\n");
-				}
-				else
-				{
-					logger->log (": Reply is missing ether the null terminator on the string, or the empty string at the end of the message.\n");
-					return -6;
-				}
+	// Finish the line the reply was streamed on
+	std::string no_body;
+	queueOutput (msg_id, no_body, "Received", OUTPUT_REPLY_END);
+}
 
-				logger->logf (": Received: %s\n", msg_body.c_str());
+// Archives the last command with the reply gathered for it, once
+void archiveReply (void)
+{
+	if (history_pending)
+	{
+		history->append (server_name, last_command_id, last_command, history_reply.data(), history_reply.size());
+		history_reply.clear ();
+		history_pending = false;
+	}
+}
 
-				// Spit out the message
-				logger->debug (DEBUG_DETAILED, ": Received: ");
-				if (debug_level >= DEBUG_DETAILED)
-				{
-					for (uint32_t t = 0; t < 4; t++)
-					{
-						logger->logx (rcon_size[t], false);
-					}
-					for (int32_t t = 0; t < data_size-1; t++)
-					{
-						logger->logx (rcon_recv[t], false);
-					}
-					logger->logx (rcon_recv[data_size-1], true);
-				}
-		
-				return data_size;
-			}
-			else if ((rcon_return != -EAGAIN) && (rcon_return != -EWOULDBLOCK) && (rcon_return != -1) && (rcon_return != 0))
+// Names the cache after the servers version, and reads it in unless the fresh list beat it here, which is cached instead
+void openCompletionCache (void)
+{
+	completion_file = CompletionIndex::cacheName (user_address, user_port, completion_version);
+	logger->debugf (DEBUG_MINIMAL, ": Using the completion cache %s.\n", completion_file.c_str());
+	if (completion_fetch != NULL)
+	{
+		completions->load (completion_file.c_str());
+	}
+	else if (completions != NULL)
+	{
+		logger->debugf (DEBUG_MINIMAL, ": Cached %d command names.\n", completions->save (completion_file.c_str()));
+	}
+}
+
+// Queues the lines of the watched commands reply that changed since the last run, or the whole reply the first time
+void showWatchChanges (int32_t msg_id)
+{
+	std::vector<std::string> added;
+	std::vector<std::string> removed;
+	if (!watch->diff (watch_response, added, removed))
+	{
+		std::string msg_body;
+		for (size_t t = 0; t < added.size (); t++)
+		{
+			if ((user_filter.empty ()) || (added[t].find (user_filter) != std::string::npos))
 			{
-				// Failed to read the message
-				logger->logf (": Error on RCON socket while reading message data: %s.\n", strerror(errno));
-				rcon_task = RCON_CLOSE;
-				return -3;
+				msg_body.append (added[t]);
+				msg_body.push_back ('\n');
 			}
 		}
-		else if ((rcon_return != -EAGAIN) && (rcon_return != -EWOULDBLOCK) && (rcon_return != -1) && (rcon_return != 0))
+		if (!msg_body.empty ())
 		{
-			// Failed to read the message
-			logger->logf (": Error on RCON socket while reading message size: %s.\n", strerror(errno));
-			rcon_task = RCON_CLOSE;
-			return -2;
+			queueOutput (msg_id, msg_body, "Received", OUTPUT_REPLY);
 		}
+		return;
 	}
-	else if (return_value < 0)
+
+	// Each changed line is its own message, so JSON logs get one event per line
+	for (size_t t = 0; t < removed.size (); t++)
 	{
-		// Failed to read available bytes from the socket
-		logger->logf (": Error, failed to read available bytes from socket, closing socket: %s.\n", strerror(errno));
-		return -1;
+		if ((user_filter.empty ()) || (removed[t].find (user_filter) != std::string::npos))
+		{
+			queueOutput (msg_id, removed[t], "Removed", OUTPUT_MESSAGE);
+		}
+	}
+	for (size_t t = 0; t < added.size (); t++)
+	{
+		if ((user_filter.empty ()) || (added[t].find (user_filter) != std::string::npos))
+		{
+			queueOutput (msg_id, added[t], "Added", OUTPUT_MESSAGE);
+		}
 	}
-	
-	return 0;
+}
+
+// Prints the commands starting with the prefix, or failing that the ones that fuzzily match it
+void showCompletions (const std::string &prefix)
+{
+	if (completions == NULL)
+	{
+		printf ("%s servers have no command list to complete from\n", session->getDialect ());
+		return;
+	}
+
+	std::vector<std::string> matches;
+	size_t count = completions->complete (prefix, matches, COMPLETION_MAX_SHOWN);
+	if (count == 0)
+	{
+		count = completions->fuzzy (prefix, matches, COMPLETION_MAX_SHOWN);
+	}
+
+	if (count == 0)
+	{
+		printf ("No commands match %s\n", prefix.c_str());
+	}
+	for (size_t t = 0; t < matches.size (); t++)
+	{
+		printf ("  %s\n", matches[t].c_str());
+	}
+	if (count > matches.size ())
+	{
+		printf ("  ... and %zu more\n", count - matches.size ());
+	}
+	fflush (stdout);
+}
+
+// Returns a steady time in microseconds, for measuring how long things take
+uint64_t monotonicMicros (void)
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
 }
 
 // Thread handles the console inputs
@@ -604,6 +1096,58 @@ void *consoleThread (void *)
 	return 0;
 }
 
+// Thread writes received replies out in the order they arrived
+void *outputThread (void *)
+{
+	traceThreadName ("output");
+
+	pthread_mutex_lock (&output_mutex);
+	while (output_running || !output_queue.empty ())
+	{
+		if (output_queue.empty ())
+		{
+			pthread_cond_wait (&output_cond, &output_mutex);
+			continue;
+		}
+
+		// Take the next reply and log it without holding the queue
+		OutputMessage msg;
+		msg.msg_id = output_queue.front ().msg_id;
+		msg.direction = output_queue.front ().direction;
+		msg.kind = output_queue.front ().kind;
+		msg.body.swap (output_queue.front ().body);
+		output_queue.pop_front ();
+		metricSetGauge (METRIC_QUEUE_DEPTH, output_queue.size ());
+		pthread_mutex_unlock (&output_mutex);
+
+		TRACE_BEGIN ("output");
+		switch (msg.kind)
+		{
+			case (OUTPUT_MESSAGE):
+			{
+				logger->logMessage (msg.direction, msg.msg_id, msg.body.data(), msg.body.size());
+			}
+			break;
+			case (OUTPUT_REPLY):
+			{
+				logger->logReplyPart (msg.direction, msg.msg_id, msg.body.data(), msg.body.size());
+			}
+			break;
+			case (OUTPUT_REPLY_END):
+			{
+				logger->endReply (msg.msg_id);
+			}
+			break;
+		}
+		TRACE_END ("output");
+
+		pthread_mutex_lock (&output_mutex);
+	}
+	pthread_mutex_unlock (&output_mutex);
+
+	return 0;
+}
+
 // Hangles the SIGTERM signal, to safely close the program down
 void signalHandler (int signum)
 {
@@ -624,5 +1168,10 @@ void signalHandler (int signum)
 			}
 		}
 		break;
+		case SIGUSR1:
+		{
+			trace_requested = 1;
+		}
+		break;
 	}
 }
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "Trace.hpp"
+
+volatile bool trace_enabled = false;
+
+// Every thread records into its own buffer, the list is only locked when a thread first traces
+static __thread struct TraceBuffer *thread_buffer = NULL;
+static std::vector<struct TraceBuffer *> trace_buffers;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Finds the calling threads buffer, creating it the first time the thread traces
+ */
+static struct TraceBuffer *getThreadBuffer (void)
+{
+	if (thread_buffer == NULL)
+	{
+		thread_buffer = (struct TraceBuffer *) calloc (1, sizeof (struct TraceBuffer));
+		thread_buffer->thread_id = syscall (SYS_gettid);
+		thread_buffer->thread_name = NULL;
+
+		pthread_mutex_lock (&trace_mutex);
+		trace_buffers.push_back (thread_buffer);
+		pthread_mutex_unlock (&trace_mutex);
+	}
+	return thread_buffer;
+}
+
+
+/**
+ * Starts recording trace points
+ */
+void traceEnable (void)
+{
+	trace_enabled = true;
+}
+
+
+/**
+ * Names the calling thread in the exported trace
+ */
+void traceThreadName (const char *name)
+{
+	if (trace_enabled)
+	{
+		getThreadBuffer ()->thread_name = name;
+	}
+}
+
+
+/**
+ * Records one event into the calling threads ring buffer
+ */
+void traceEvent (const char *name, char phase, int64_t id)
+{
+	struct TraceBuffer *buffer = getThreadBuffer ();
+	struct TraceEvent *event = &buffer->events[buffer->count % TRACE_BUFFER_EVENTS];
+
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	event->name = name;
+	event->time_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	event->id = id;
+	event->phase = phase;
+
+	// Publish the event, traceWrite reads the count from another thread
+	__atomic_store_n (&buffer->count, buffer->count + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Writes every recorded event out as a Chrome trace / Perfetto JSON file, returns how many
+ * events were written or -1 if the file couldn't be opened
+ */
+int traceWrite (const char *file_name)
+{
+	FILE *trace_file = fopen (file_name, "w");
+	if (trace_file == NULL)
+	{
+		return -1;
+	}
+
+	int written = 0;
+	pid_t process_id = getpid ();
+	fprintf (trace_file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	pthread_mutex_lock (&trace_mutex);
+	for (size_t b = 0; b < trace_buffers.size (); b++)
+	{
+		struct TraceBuffer *buffer = trace_buffers[b];
+
+		if (buffer->thread_name != NULL)
+		{
+			fprintf (trace_file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				(written > 0) ? ",\n" : "", process_id, buffer->thread_id, buffer->thread_name);
+			written++;
+		}
+
+		// Start from the oldest event still held in the ring
+		uint64_t count = __atomic_load_n (&buffer->count, __ATOMIC_ACQUIRE);
+		uint64_t first = (count > TRACE_BUFFER_EVENTS) ? count - TRACE_BUFFER_EVENTS : 0;
+		for (uint64_t t = first; t < count; t++)
+		{
+			// The thread keeps tracing while this runs, so skip events overwritten before they were copied
+			struct TraceEvent copy = buffer->events[t % TRACE_BUFFER_EVENTS];
+			__atomic_thread_fence (__ATOMIC_ACQUIRE);
+			if (__atomic_load_n (&buffer->count, __ATOMIC_RELAXED) - t > TRACE_BUFFER_EVENTS)
+			{
+				continue;
+			}
+			struct TraceEvent *event = &copy;
+
+			fprintf (trace_file, "%s{\"name\":\"%s\",\"cat\":\"ssrcon\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%d",
+				(written > 0) ? ",\n" : "", event->name, event->phase,
+				(unsigned long long)(event->time_ns / 1000), (unsigned)(event->time_ns % 1000), process_id, buffer->thread_id);
+			if ((event->phase == 'b') || (event->phase == 'e'))
+			{
+				fprintf (trace_file, ",\"id\":%lld", (long long)event->id);
+			}
+			else if (event->phase == 'i')
+			{
+				fprintf (trace_file, ",\"s\":\"t\",\"args\":{\"id\":%lld}", (long long)event->id);
+			}
+			fputc ('}', trace_file);
+			written++;
+		}
+	}
+	pthread_mutex_unlock (&trace_mutex);
+
+	fprintf (trace_file, "\n]}\n");
+	fclose (trace_file);
+	return written;
+}
@@ -0,0 +1,42 @@
+#ifndef	_TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// How many events each thread keeps before the oldest are overwritten
+#define TRACE_BUFFER_EVENTS	8192
+
+// Trace points cost a single flag check while tracing is off
+#define TRACE_BEGIN(name)			do { if (trace_enabled) traceEvent (name, 'B', 0); } while (0)
+#define TRACE_END(name)				do { if (trace_enabled) traceEvent (name, 'E', 0); } while (0)
+#define TRACE_INSTANT(name, id)		do { if (trace_enabled) traceEvent (name, 'i', id); } while (0)
+#define TRACE_ASYNC_BEGIN(name, id)	do { if (trace_enabled) traceEvent (name, 'b', id); } while (0)
+#define TRACE_ASYNC_END(name, id)	do { if (trace_enabled) traceEvent (name, 'e', id); } while (0)
+
+// A single trace point, the name must be a string that lives for the whole process
+struct TraceEvent
+{
+	const char *name;
+	uint64_t time_ns;
+	int64_t id;
+	char phase;
+};
+
+// The events recorded by one thread
+struct TraceBuffer
+{
+	pid_t thread_id;
+	const char *thread_name;
+	uint64_t count;
+	struct TraceEvent events[TRACE_BUFFER_EVENTS];
+};
+
+extern volatile bool trace_enabled;
+
+void traceEnable (void);
+void traceThreadName (const char *name);
+void traceEvent (const char *name, char phase, int64_t id);
+int traceWrite (const char *file_name);
+
+#endif
@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Watch.hpp"
+
+/**
+ * Creates a diff with no previous response
+ */
+WatchDiff::WatchDiff ()
+{
+	has_previous = false;
+}
+
+
+/**
+ * Destroys the diff
+ */
+WatchDiff::~WatchDiff ()
+{
+}
+
+
+/**
+ * Hashes a line with 64 bit FNV-1a
+ */
+uint64_t WatchDiff::hashLine (const char *text, size_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t t = 0; t < length; t++)
+	{
+		hash ^= (uint8_t)text[t];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+/**
+ * Compares the response with the last one, filling added and removed with the lines only in one of
+ * them, in the order they appear. Lines are matched by content wherever they are, so a changed line
+ * shows up as removed and added and lines that only moved aren't reported. Returns false if this is
+ * the first response, which has nothing to compare against so all of its lines are added
+ */
+bool WatchDiff::diff (const std::string &response, std::vector<std::string> &added, std::vector<std::string> &removed)
+{
+	// Split the response into hashed lines, skipping blank ones
+	std::vector<struct WatchLine> current;
+	const char *text = response.data ();
+	const char *end = text + response.size ();
+	while (text < end)
+	{
+		const char *line_end = (const char *)memchr (text, '\n', end - text);
+		if (line_end == NULL)
+		{
+			line_end = end;
+		}
+		size_t length = line_end - text;
+		if ((length > 0) && (text[length - 1] == '\r'))
+		{
+			length--;
+		}
+		if (length > 0)
+		{
+			struct WatchLine line;
+			line.hash = hashLine (text, length);
+			line.text.assign (text, length);
+			current.push_back (line);
+		}
+		text = line_end + 1;
+	}
+
+	bool had_previous = has_previous;
+	if (had_previous)
+	{
+		// Count each line on both sides, a line is only reported for the copies the other side lacks
+		std::unordered_map<uint64_t, uint32_t> previous_counts;
+		std::unordered_map<uint64_t, uint32_t> current_counts;
+		for (size_t t = 0; t < previous.size (); t++)
+		{
+			previous_counts[previous[t].hash]++;
+		}
+		for (size_t t = 0; t < current.size (); t++)
+		{
+			current_counts[current[t].hash]++;
+		}
+
+		for (size_t t = 0; t < previous.size (); t++)
+		{
+			std::unordered_map<uint64_t, uint32_t>::iterator count = current_counts.find (previous[t].hash);
+			if ((count != current_counts.end ()) && (count->second > 0))
+			{
+				count->second--;
+			}
+			else
+			{
+				removed.push_back (previous[t].text);
+			}
+		}
+		for (size_t t = 0; t < current.size (); t++)
+		{
+			std::unordered_map<uint64_t, uint32_t>::iterator count = previous_counts.find (current[t].hash);
+			if ((count != previous_counts.end ()) && (count->second > 0))
+			{
+				count->second--;
+			}
+			else
+			{
+				added.push_back (current[t].text);
+			}
+		}
+	}
+	else
+	{
+		for (size_t t = 0; t < current.size (); t++)
+		{
+			added.push_back (current[t].text);
+		}
+	}
+
+	previous.swap (current);
+	has_previous = true;
+	return had_previous;
+}
@@ -0,0 +1,43 @@
+#ifndef	_WATCH_H
+#define _WATCH_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// How many intervals a run of the watched command gets to finish before it's given up on, and the
+// least time it gets in microseconds, so short intervals don't give up on a slow server
+#define WATCH_TIMEOUT_INTERVALS	3
+#define WATCH_MIN_TIMEOUT	1000000
+
+// Define the WatchDiff class
+class WatchDiff;
+
+// Build the WatchDiff class Template
+class WatchDiff
+{
+private:
+	// A line of a response with its hash, lines are compared by hash
+	struct WatchLine
+	{
+		uint64_t hash;
+		std::string text;
+	};
+
+	// Private variables
+	std::vector<struct WatchLine> previous;
+	bool has_previous;
+
+	// Private methods
+	static uint64_t hashLine (const char *text, size_t length);
+
+public:
+	// Constructors and destructor
+	WatchDiff ();
+	~WatchDiff ();
+
+	// Public methods
+	bool diff (const std::string &response, std::vector<std::string> &added, std::vector<std::string> &removed);
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "RCONCodec.hpp"
+
+// How long each measurement runs for, in nanoseconds
+#define BENCH_TIME	200000000ULL
+
+// How many bytes of messages each pass works through, so small bodies aren't all loop overhead
+#define BENCH_PASS_BYTES	(1024 * 1024)
+
+/**
+ * Returns a steady time in nanoseconds
+ */
+static uint64_t benchNanos (void)
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+/**
+ * Prints the time per message and the throughput for one measurement
+ */
+static void benchReport (const char *name, uint32_t body_length, uint64_t frames, uint64_t bytes, uint64_t nanos)
+{
+	printf ("%-8s %8u %12.2f %10.3f\n", name, body_length, (double)nanos / frames, (double)bytes / nanos);
+}
+
+
+/**
+ * Measures encoding and decoding messages with bodies of each size, the throughput counts every
+ * byte of each message including its header, decoding points into the buffer rather than copying
+ * the body so its time barely grows with the body
+ */
+int main (int, char **)
+{
+	static const uint32_t body_lengths[] = { 0, 16, 64, 256, 1024, 4096, 16384, RCON_BUFFER_SIZE - RCON_FRAME_OVERHEAD };
+	uint64_t checksum = 0;
+
+	printf ("%-8s %8s %12s %10s\n", "test", "body", "ns/frame", "GB/s");
+	for (size_t b = 0; b < sizeof (body_lengths) / sizeof (body_lengths[0]); b++)
+	{
+		uint32_t body_length = body_lengths[b];
+		uint32_t frame_length = body_length + RCON_FRAME_OVERHEAD;
+		uint32_t frame_count = (BENCH_PASS_BYTES / frame_length > 0) ? BENCH_PASS_BYTES / frame_length : 1;
+
+		std::vector<char> body (body_length + 1, 'x');
+		std::vector<uint8_t> frames ((size_t)frame_length * frame_count);
+
+		// Encode passes over the whole buffer until the time is up
+		uint64_t passes = 0;
+		uint64_t start = benchNanos ();
+		uint64_t now = start;
+		while (now - start < BENCH_TIME)
+		{
+			uint8_t *out = &frames[0];
+			for (uint32_t t = 0; t < frame_count; t++)
+			{
+				out += rconEncodeFrame (out, &body[0], body_length, t, SERVERDATA_RESPONSE_VALUE);
+			}
+			passes++;
+			now = benchNanos ();
+		}
+		benchReport ("encode", body_length, passes * frame_count, passes * frame_count * frame_length, now - start);
+
+		// Decode walks the buffer the same way a session does
+		passes = 0;
+		start = benchNanos ();
+		now = start;
+		while (now - start < BENCH_TIME)
+		{
+			uint32_t offset = 0;
+			struct RCONFrame frame;
+			while ((offset < frames.size ()) && (rconDecodeFrame (&frames[offset], frames.size () - offset, RCON_BUFFER_SIZE - 4, &frame) > 0))
+			{
+				checksum += frame.msg_id + frame.body_length;
+				offset += frame.data_size + 4;
+			}
+			passes++;
+			now = benchNanos ();
+		}
+		benchReport ("decode", body_length, passes * frame_count, passes * frame_count * frame_length, now - start);
+	}
+
+	// Printed so the decoding can't be optimised away
+	fprintf (stderr, "checksum %llu\n", (unsigned long long)checksum);
+	return 0;
+}
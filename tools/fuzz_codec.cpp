@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "RCONCodec.hpp"
+
+/**
+ * Decodes every message in the input the way a session walks its buffer, and checks each one
+ * encodes back to exactly the bytes it was decoded from
+ */
+extern "C" int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size)
+{
+	uint32_t length = (size > RCON_BUFFER_SIZE) ? RCON_BUFFER_SIZE : size;
+	uint32_t offset = 0;
+	std::vector<uint8_t> encoded;
+
+	while (offset < length)
+	{
+		struct RCONFrame frame;
+		int return_value = rconDecodeFrame (&data[offset], length - offset, RCON_BUFFER_SIZE - 4, &frame);
+		if ((return_value == RCON_DECODE_INCOMPLETE) || (return_value == RCON_DECODE_BAD_SIZE))
+		{
+			break;
+		}
+
+		// The message has to sit inside the input
+		uint32_t frame_length = frame.data_size + 4;
+		if ((frame.data_size < RCON_MIN_DATA_SIZE) || (frame_length > length - offset) ||
+			(frame.body != (const char *)&data[offset + 12]) || (frame.body_length + RCON_FRAME_OVERHEAD != frame_length))
+		{
+			abort ();
+		}
+
+		if (return_value > 0)
+		{
+			encoded.resize (frame_length);
+			if ((rconEncodeFrame (&encoded[0], frame.body, frame.body_length, frame.msg_id, frame.msg_type) != frame_length) ||
+				(memcmp (&encoded[0], &data[offset], frame_length) != 0))
+			{
+				abort ();
+			}
+		}
+
+		offset += frame_length;
+	}
+
+	return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+/**
+ * Runs each file named on the command line through the harness, or stdin if there are none, so it
+ * can be driven by AFL or used to replay a crash
+ */
+int main (int argc, char **argv)
+{
+	for (int arg_count = (argc > 1) ? 1 : 0; arg_count < argc; arg_count++)
+	{
+		FILE *input_file = (argc > 1) ? fopen (argv[arg_count], "rb") : stdin;
+		if (input_file == NULL)
+		{
+			fprintf (stderr, "Unable to open %s.\n", argv[arg_count]);
+			return 1;
+		}
+
+		std::vector<uint8_t> input;
+		uint8_t chunk[4096];
+		size_t read_length;
+		while ((read_length = fread (chunk, 1, sizeof (chunk), input_file)) > 0)
+		{
+			input.insert (input.end (), chunk, chunk + read_length);
+		}
+		if (input_file != stdin)
+		{
+			fclose (input_file);
+		}
+
+		LLVMFuzzerTestOneInput ((input.size () > 0) ? &input[0] : NULL, input.size ());
+	}
+
+	return 0;
+}
+#endif
@@ -0,0 +1,325 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "RCONCodec.hpp"
+
+// The largest packet a Source server sends, longer replies are split across several
+#define STAND_IN_SOURCE_PACKET	4096
+
+// Minecraft splits replies every this many characters
+#define STAND_IN_MINECRAFT_FRAGMENT	4096
+
+// How many lines the big command replies with
+#define STAND_IN_BIG_LINES	1000
+
+// How many connections are served at once
+#define STAND_IN_MAX_CLIENTS	256
+
+// The servers the stand in can pretend to be
+#define STAND_IN_SOURCE		0
+#define STAND_IN_MINECRAFT	1
+#define STAND_IN_FACTORIO	2
+
+// A connection and the bytes read from it that haven't made a whole message yet
+struct StandInClient
+{
+	int sock;
+	bool authorised;
+	std::vector<uint8_t> buffer;
+};
+
+/**
+ * Encodes a message and writes all of it to the client, returns false if the client has gone
+ */
+static bool standInSend (int sock, const char *body, uint32_t body_length, int32_t msg_id, int32_t msg_type)
+{
+	std::vector<uint8_t> frame (body_length + RCON_FRAME_OVERHEAD);
+	uint32_t frame_length = rconEncodeFrame (&frame[0], body, body_length, msg_id, msg_type);
+
+	uint32_t sent = 0;
+	while (sent < frame_length)
+	{
+		ssize_t send_length = send (sock, &frame[sent], frame_length - sent, MSG_NOSIGNAL);
+		if (send_length <= 0)
+		{
+			return false;
+		}
+		sent += send_length;
+	}
+	return true;
+}
+
+
+/**
+ * Sends a reply split the way the server being stood in for would split it
+ */
+static bool standInReply (int sock, uint8_t mode, const std::string &reply, int32_t msg_id)
+{
+	uint32_t packet_size = reply.size ();
+	if (mode == STAND_IN_SOURCE)
+	{
+		packet_size = STAND_IN_SOURCE_PACKET;
+	}
+	else if (mode == STAND_IN_MINECRAFT)
+	{
+		packet_size = STAND_IN_MINECRAFT_FRAGMENT;
+	}
+
+	// Every reply sends at least one packet, even when it is empty
+	uint32_t offset = 0;
+	do
+	{
+		uint32_t body_length = (reply.size () - offset < packet_size) ? reply.size () - offset : packet_size;
+		if (!standInSend (sock, reply.data () + offset, body_length, msg_id, SERVERDATA_RESPONSE_VALUE))
+		{
+			return false;
+		}
+		offset += body_length;
+	}
+	while (offset < reply.size ());
+	return true;
+}
+
+
+/**
+ * Works out the reply to a command, status changes every time it is run so watching it shows a diff
+ */
+static std::string standInCommand (uint8_t mode, const std::string &command)
+{
+	static uint32_t status_count = 0;
+	std::string reply;
+
+	if (command == "status")
+	{
+		char line[64];
+		status_count++;
+		reply = "hostname: SSRCON stand in\nplayers : 2 humans, 0 bots\n";
+		snprintf (line, sizeof (line), "# 1 \"alice\" STEAM_1:0:1 00:%02u\n", status_count % 60);
+		reply += line;
+		snprintf (line, sizeof (line), "# 2 \"bob%u\" STEAM_1:0:2 00:01\n", status_count % 3);
+		reply += line;
+	}
+	else if (command == "big")
+	{
+		char line[64];
+		for (uint32_t t = 0; t < STAND_IN_BIG_LINES; t++)
+		{
+			snprintf (line, sizeof (line), "line %04u of the big reply\n", t);
+			reply += line;
+		}
+	}
+	else if ((command == "cvarlist") && (mode == STAND_IN_SOURCE))
+	{
+		static const char *cvars[] = { "changelevel", "exec", "kick", "kickid", "log", "mp_friendlyfire", "mp_maxrounds",
+			"mp_roundtime", "mp_timelimit", "status", "sv_cheats", "sv_gravity", "sv_password", "users" };
+		reply = "cvar list\n--------------\n";
+		for (size_t t = 0; t < sizeof (cvars) / sizeof (cvars[0]); t++)
+		{
+			reply += cvars[t];
+			reply += "                              : cmd      :                  :\n";
+		}
+		reply += "--------------\n";
+	}
+	else if ((command == "cvarlist") && (mode == STAND_IN_MINECRAFT))
+	{
+		reply = "Unknown command. Type \"/help\" for help.";
+	}
+	else
+	{
+		reply = "echo: " + command + "\n";
+	}
+
+	return reply;
+}
+
+
+/**
+ * Handles one message from a client, returns false if the connection should be closed
+ */
+static bool standInMessage (struct StandInClient *client, uint8_t mode, const char *password, const struct RCONFrame &frame)
+{
+	std::string body (frame.body, frame.body_length);
+
+	if (frame.msg_type == SERVERDATA_AUTH)
+	{
+		client->authorised = (body == password);
+		printf ("Client %d %s.\n", client->sock, client->authorised ? "authorised" : "used the wrong password");
+
+		// Source sends an empty reply before the auth response
+		if ((mode == STAND_IN_SOURCE) && (!standInSend (client->sock, "", 0, frame.msg_id, SERVERDATA_RESPONSE_VALUE)))
+		{
+			return false;
+		}
+		return standInSend (client->sock, "", 0, client->authorised ? frame.msg_id : -1, SERVERDATA_AUTH_RESPONSE);
+	}
+
+	// Anything before a successful auth drops the connection, as srcds does
+	if (!client->authorised)
+	{
+		return false;
+	}
+
+	if (frame.msg_type == SERVERDATA_EXECCOMMAND)
+	{
+		return standInReply (client->sock, mode, standInCommand (mode, body), frame.msg_id);
+	}
+
+	// Source mirrors an empty response value, then sends another that doesn't match it, which
+	// is what clients look for to find the end of a reply
+	if ((frame.msg_type == SERVERDATA_RESPONSE_VALUE) && (mode == STAND_IN_SOURCE))
+	{
+		static const char junk[] = { 0, 1, 0, 0 };
+		return standInSend (client->sock, "", 0, frame.msg_id, SERVERDATA_RESPONSE_VALUE) &&
+			standInSend (client->sock, junk, sizeof (junk), frame.msg_id, SERVERDATA_RESPONSE_VALUE);
+	}
+
+	return true;
+}
+
+
+/**
+ * Reads whatever the client has sent and handles every whole message in it, returns false if the
+ * connection should be closed
+ */
+static bool standInRead (struct StandInClient *client, uint8_t mode, const char *password)
+{
+	uint8_t chunk[RCON_BUFFER_SIZE];
+	ssize_t recv_length = recv (client->sock, chunk, sizeof (chunk), 0);
+	if (recv_length <= 0)
+	{
+		return false;
+	}
+	client->buffer.insert (client->buffer.end (), chunk, chunk + recv_length);
+
+	uint32_t offset = 0;
+	while (offset < client->buffer.size ())
+	{
+		struct RCONFrame frame;
+		int return_value = rconDecodeFrame (&client->buffer[offset], client->buffer.size () - offset, RCON_BUFFER_SIZE - 4, &frame);
+		if (return_value == RCON_DECODE_INCOMPLETE)
+		{
+			break;
+		}
+		if (return_value < 0)
+		{
+			printf ("Client %d sent a malformed message.\n", client->sock);
+			return false;
+		}
+		offset += frame.data_size + 4;
+
+		if (!standInMessage (client, mode, password, frame))
+		{
+			return false;
+		}
+	}
+	client->buffer.erase (client->buffer.begin (), client->buffer.begin () + offset);
+	return true;
+}
+
+
+/**
+ * A small RCON server to run SSRCON and its load test against without a game server, it answers
+ * status, big and cvarlist and echoes anything else, splitting replies the way the server named
+ * on the command line does
+ */
+int main (int argc, char **argv)
+{
+	if ((argc < 3) || (argc > 4))
+	{
+		fprintf (stderr, "Usage: %s port password [source|minecraft|factorio]\n", argv[0]);
+		return 1;
+	}
+	int port = atoi (argv[1]);
+	const char *password = argv[2];
+	uint8_t mode = STAND_IN_SOURCE;
+	if ((argc == 4) && (strcmp (argv[3], "minecraft") == 0))
+	{
+		mode = STAND_IN_MINECRAFT;
+	}
+	else if ((argc == 4) && (strcmp (argv[3], "factorio") == 0))
+	{
+		mode = STAND_IN_FACTORIO;
+	}
+	else if ((argc == 4) && (strcmp (argv[3], "source") != 0))
+	{
+		fprintf (stderr, "Unknown server type %s.\n", argv[3]);
+		return 1;
+	}
+
+	int listen_sock = socket (AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	setsockopt (listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+	struct sockaddr_in listen_address;
+	memset (&listen_address, 0, sizeof (listen_address));
+	listen_address.sin_family = AF_INET;
+	listen_address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	listen_address.sin_port = htons (port);
+	if ((bind (listen_sock, (struct sockaddr *)&listen_address, sizeof (listen_address)) < 0) || (listen (listen_sock, 64) < 0))
+	{
+		fprintf (stderr, "Unable to listen on port %d: %s.\n", port, strerror (errno));
+		return 1;
+	}
+	printf ("Listening on 127.0.0.1:%d.\n", port);
+	fflush (stdout);
+
+	std::vector<struct StandInClient> clients;
+	std::vector<struct pollfd> poll_fds;
+	while (true)
+	{
+		// The listening socket is always first, followed by every client in order
+		poll_fds.resize (clients.size () + 1);
+		poll_fds[0].fd = listen_sock;
+		poll_fds[0].events = POLLIN;
+		for (size_t t = 0; t < clients.size (); t++)
+		{
+			poll_fds[t + 1].fd = clients[t].sock;
+			poll_fds[t + 1].events = POLLIN;
+		}
+		if (poll (&poll_fds[0], poll_fds.size (), -1) < 0)
+		{
+			continue;
+		}
+
+		// Work backwards so closed clients can be removed as they're found
+		for (size_t t = clients.size (); t > 0; t--)
+		{
+			if ((poll_fds[t].revents != 0) && (!standInRead (&clients[t - 1], mode, password)))
+			{
+				printf ("Client %d closed.\n", clients[t - 1].sock);
+				close (clients[t - 1].sock);
+				clients.erase (clients.begin () + (t - 1));
+			}
+		}
+
+		if (poll_fds[0].revents & POLLIN)
+		{
+			int client_sock = accept (listen_sock, NULL, NULL);
+			if ((client_sock >= 0) && (clients.size () >= STAND_IN_MAX_CLIENTS))
+			{
+				close (client_sock);
+			}
+			else if (client_sock >= 0)
+			{
+				struct StandInClient client;
+				client.sock = client_sock;
+				client.authorised = false;
+				clients.push_back (client);
+				printf ("Client %d connected.\n", client_sock);
+			}
+		}
+		fflush (stdout);
+	}
+
+	return 0;
+}